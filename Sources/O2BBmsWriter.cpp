@@ -0,0 +1,126 @@
+#include "O2BBmsWriter.hpp"
+
+#include <cstdio>
+
+#include "_Detail/Utilities.hpp"
+
+namespace Osu2Bms {
+
+    namespace {
+
+        // The first 36 are the base 36 digits
+        const char base62Digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+        size_t Gcd(size_t a, size_t b) {
+            while (b != 0) {
+                auto t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        // Same text as an ostream with precision 15, without the allocations
+        struct FormattedNumber {
+            explicit FormattedNumber(double value) {
+                std::snprintf(Text, sizeof(Text), "%.15g", value);
+            }
+            char Text[32];
+        };
+
+    }
+
+    O2BBmsWriter::O2BBmsWriter(std::ostream &out)
+        : _Out(out), _Line(_OwnLine), _Base(36) {}
+
+    O2BBmsWriter::O2BBmsWriter(std::ostream &out, std::string &lineBuffer)
+        : _Out(out), _Line(lineBuffer), _Base(36) {}
+
+    void O2BBmsWriter::WriteField(const std::string &name, std::string_view value) {
+        _Out << '#' << name << ' ' << value << '\n';
+    }
+
+    void O2BBmsWriter::WriteField(const std::string &name, double value) {
+        _Out << '#' << name << ' ' << FormattedNumber(value).Text << '\n';
+    }
+
+    void O2BBmsWriter::WriteDefinition(const std::string &name, size_t referenceId, std::string_view value) {
+        _WriteDefinition(name, referenceId, value);
+    }
+
+    void O2BBmsWriter::WriteDefinition(const std::string &name, size_t referenceId, double value) {
+        _WriteDefinition(name, referenceId, FormattedNumber(value).Text);
+    }
+
+    void O2BBmsWriter::WriteBase(size_t base) {
+        SetBase(base);
+        _Out << "#BASE " << base << '\n';
+    }
+
+    void O2BBmsWriter::SetBase(size_t base) {
+        if (base != 36 && base != 62) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": Reference ID base must be 36 or 62");
+        }
+        _Base = base;
+    }
+
+    void O2BBmsWriter::BeginMainData() {
+        _Out << '\n';
+    }
+
+    void O2BBmsWriter::WriteChannel(
+        uint16_t section,
+        Bms::BmsChannelId channel,
+        const _Detail::GridBitmap &occupied,
+        const uint16_t *cells,
+        size_t gridSize) {
+        if (!occupied.Any()) {
+            return;
+        }
+        if (section > 999) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": Section number exceeds 999");
+        }
+        size_t step = gridSize;
+        occupied.ForEach([&step](size_t i) {
+            step = Gcd(step, i);
+        });
+        char prefix[8];
+        std::snprintf(prefix, sizeof(prefix), "#%03u%02u:",
+            static_cast<unsigned>(section), static_cast<unsigned>(channel));
+        _Line.assign(prefix);
+        for (size_t i = 0; i < gridSize; i += step) {
+            _AppendReferenceId(occupied.Test(i) ? cells[i] : 0);
+        }
+        _Line += '\n';
+        _Out.write(_Line.data(), _Line.size());
+    }
+
+    void O2BBmsWriter::Flush() {
+        _Out.flush();
+    }
+
+    void O2BBmsWriter::_WriteDefinition(const std::string &name, size_t referenceId, std::string_view value) {
+        _Line.assign(1, '#');
+        _Line += name;
+        _AppendReferenceId(referenceId);
+        _Line += ' ';
+        _Line += value;
+        _Line += '\n';
+        _Out.write(_Line.data(), _Line.size());
+    }
+
+    void O2BBmsWriter::_AppendReferenceId(size_t referenceId) {
+        if (referenceId >= _Base * _Base) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + (_Base == 36 ? ": Reference ID out of range [00, ZZ]" : ": Reference ID out of range [00, zz]"));
+        }
+        _Line += base62Digits[referenceId / _Base];
+        _Line += base62Digits[referenceId % _Base];
+    }
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_BMS_WRITER_HPP_INCLUDED
+#define OSU_2_BMS_O2B_BMS_WRITER_HPP_INCLUDED
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include <Bms.hpp>
+
+#include "O2BException.hpp"
+#include "_Detail/GridBitmap.hpp"
+
+namespace Osu2Bms {
+
+    // Writes BMS text straight to a stream, so a converted chart never has
+    // to exist as a whole Bms::BmsBeatmap or as one big string.
+    // Header lines come first, then channel lines section by section.
+    class O2BBmsWriter {
+    public:
+        explicit O2BBmsWriter(std::ostream &out);
+        // Builds lines in lineBuffer, so that its capacity outlives the writer
+        O2BBmsWriter(std::ostream &out, std::string &lineBuffer);
+    public:
+        void WriteField(const std::string &name, std::string_view value);
+        void WriteField(const std::string &name, double value);
+        void WriteDefinition(const std::string &name, size_t referenceId, std::string_view value);
+        void WriteDefinition(const std::string &name, size_t referenceId, double value);
+        // Writes #BASE; later reference IDs are written in base, 36 or 62
+        void WriteBase(size_t base);
+        // The same without writing #BASE, for a writer continuing another's output
+        void SetBase(size_t base);
+        void BeginMainData();
+        // Writes cells[i] for every i set in occupied, on the coarsest grid
+        // dividing gridSize which still holds every occupied index
+        void WriteChannel(
+            uint16_t section,
+            Bms::BmsChannelId channel,
+            const _Detail::GridBitmap &occupied,
+            const uint16_t *cells,
+            size_t gridSize);
+        void Flush();
+    private:
+        std::ostream &_Out;
+        std::string _OwnLine;
+        std::string &_Line;
+        size_t _Base;
+    private:
+        void _WriteDefinition(const std::string &name, size_t referenceId, std::string_view value);
+        void _AppendReferenceId(size_t referenceId);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_BMS_WRITER_HPP_INCLUDED
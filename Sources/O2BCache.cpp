@@ -0,0 +1,140 @@
+#include "O2BCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include "_Detail/Hash.hpp"
+
+namespace Osu2Bms {
+
+    using namespace std::experimental::filesystem;
+
+    namespace {
+
+        // Bump whenever the converter output changes for the same input and options
+        const char cacheFormat[] = "osu2bms-cache-3";
+
+        const char entryExtension[] = ".bms";
+
+    }
+
+    O2BCache::O2BCache(const std::string &directory, uintmax_t maxSize)
+        : _Directory(directory), _MaxSize(maxSize), _Hits(0), _Misses(0), _Evictions(0), _NextTemporary(0) {
+        std::error_code error;
+        create_directories(_Directory, error);
+        if (error) {
+            throw O2BException("Could not create cache directory at " + _Directory + ": " + error.message());
+        }
+    }
+
+    // 128 bits, from two independently seeded hashes over the same bytes
+    std::string O2BCache::Key(std::string_view input, const std::string &parameters) {
+        auto seed = _Detail::Hash64(parameters.data(), parameters.size(), _Detail::Hash64(cacheFormat, sizeof(cacheFormat) - 1));
+        auto low = _Detail::Hash64(input.data(), input.size(), seed);
+        auto high = _Detail::Hash64(input.data(), input.size(), _Detail::Mix64(seed + 1));
+        char key[33];
+        std::snprintf(key, sizeof(key), "%016llx%016llx",
+            static_cast<unsigned long long>(high), static_cast<unsigned long long>(low));
+        return key;
+    }
+
+    std::string O2BCache::SerializeOptions(const O2BConvertionOptions &options) {
+        std::ostringstream ss;
+        ss.precision(17);
+        ss << "bpm=" << options.CustomBpm
+            << ";meter=" << static_cast<unsigned>(options.CustomMeter)
+            << ";grid=" << static_cast<unsigned>(options.GridSize)
+            << ";tolerance=" << options.GridTolerance
+            << ";offset=" << options.Offset
+            << ";flags=" << options.WithTimingPoints << options.WithInheritedTimingPoints
+            << options.WithBmps << options.WithEventSounds << options.WithKeySounds << options.WithBga
+            << options.WithWavRedefinition
+            << ";base=" << static_cast<unsigned>(options.ReferenceBase)
+            << ";bpmTolerance=" << options.BpmTolerance
+            << ";maxBpms=" << options.MaxBpmCount
+            << ";keys=";
+        for (auto channel : options.KeyMap) {
+            ss << static_cast<unsigned>(channel) << ',';
+        }
+        return ss.str();
+    }
+
+    bool O2BCache::Fetch(const std::string &key, const std::string &outputPath) {
+        std::error_code error;
+        auto entry = _EntryPath(key);
+        if (!exists(entry, error) || !copy_file(entry, outputPath, copy_options::overwrite_existing, error)) {
+            ++_Misses;
+            return false;
+        }
+        // Marks the entry as recently used; failing to do so only affects eviction order
+        last_write_time(entry, file_time_type::clock::now(), error);
+        ++_Hits;
+        return true;
+    }
+
+    // Copied under a unique temporary name first, so a concurrent Fetch of the
+    // same key never sees a partial file. A failed store only costs a later miss.
+    void O2BCache::Store(const std::string &key, const std::string &outputPath) {
+        std::error_code error;
+        auto entry = _EntryPath(key);
+        auto temporary = entry + ".tmp" + std::to_string(_NextTemporary++);
+        if (!copy_file(outputPath, temporary, copy_options::overwrite_existing, error)) {
+            return;
+        }
+        rename(temporary, entry, error);
+        if (error) {
+            remove(temporary, error);
+        }
+    }
+
+    void O2BCache::Trim() {
+        std::error_code error;
+        std::vector<std::tuple<file_time_type, uintmax_t, path>> entries;
+        uintmax_t totalSize = 0;
+        for (directory_iterator it(_Directory, error), end; !error && it != end; it.increment(error)) {
+            const auto &file = it->path();
+            if (file.extension() != entryExtension) {
+                continue;
+            }
+            auto size = file_size(file, error);
+            auto time = last_write_time(file, error);
+            if (error) {
+                error.clear();
+                continue;
+            }
+            entries.emplace_back(time, size, file);
+            totalSize += size;
+        }
+        std::sort(entries.begin(), entries.end());
+        for (const auto &entry : entries) {
+            if (totalSize <= _MaxSize) {
+                break;
+            }
+            if (remove(std::get<2>(entry), error)) {
+                totalSize -= std::get<1>(entry);
+                ++_Evictions;
+            }
+        }
+    }
+
+    size_t O2BCache::Hits() const {
+        return _Hits;
+    }
+
+    size_t O2BCache::Misses() const {
+        return _Misses;
+    }
+
+    size_t O2BCache::Evictions() const {
+        return _Evictions;
+    }
+
+    std::string O2BCache::_EntryPath(const std::string &key) const {
+        return (path(_Directory) / (key + entryExtension)).string();
+    }
+
+}
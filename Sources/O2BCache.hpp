@@ -0,0 +1,47 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_CACHE_HPP_INCLUDED
+#define OSU_2_BMS_O2B_CACHE_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "O2BConvertionOptions.hpp"
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // On-disk cache of converted BMS files, keyed by the input bytes and the
+    // options they were converted with. Entries are flat files named after
+    // their key. Fetching an entry refreshes its modification time, and Trim
+    // evicts the least recently used entries until the cache fits its size limit.
+    // Fetch and Store may be called from several threads at once.
+    class O2BCache {
+    public:
+        O2BCache(const std::string &directory, uintmax_t maxSize);
+    public:
+        // Options which change the output must all be part of parameters
+        static std::string Key(std::string_view input, const std::string &parameters);
+        static std::string SerializeOptions(const O2BConvertionOptions &options);
+        // Copies the entry to outputPath, returns false if there is none
+        bool Fetch(const std::string &key, const std::string &outputPath);
+        void Store(const std::string &key, const std::string &outputPath);
+        void Trim();
+        size_t Hits() const;
+        size_t Misses() const;
+        size_t Evictions() const;
+    private:
+        std::string _Directory;
+        uintmax_t _MaxSize;
+        std::atomic<size_t> _Hits;
+        std::atomic<size_t> _Misses;
+        std::atomic<size_t> _Evictions;
+        std::atomic<size_t> _NextTemporary;
+    private:
+        std::string _EntryPath(const std::string &key) const;
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_CACHE_HPP_INCLUDED
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_CHART_HPP_INCLUDED
+#define OSU_2_BMS_O2B_CHART_HPP_INCLUDED
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Osu2Bms {
+
+    // The parts of an osu!mania beatmap O2BConverter consumes. Strings are
+    // views into the text (or Osu::OsuBeatmap) the chart was read from,
+    // which has to outlive the chart.
+    struct O2BChart {
+        struct TimingPoint {
+            int32_t Time;
+            double BeatsPerMinute; // Uninherited points only: 60000 / BeatLength
+            double Ratio; // Inherited points only: -BeatLength / 100
+            uint8_t Meter;
+            bool Inherited;
+        };
+        struct HitObject {
+            int32_t StartTime;
+            int32_t EndTime; // Holds only
+            uint8_t Column;
+            bool IsHold;
+            std::string_view HitSound; // Empty if there is no custom key sound
+        };
+        enum class EventType : uint8_t {
+            Background,
+            Video,
+            SoundEffect
+        };
+        struct Event {
+            EventType Type;
+            int32_t Time;
+            std::string_view FilePath;
+        };
+        std::string_view AudioFilename;
+        int32_t AudioLeadIn = 0;
+        std::string_view ArtistUnicode;
+        std::string_view TitleUnicode;
+        uint8_t KeyCount = 0;
+        std::vector<TimingPoint> TimingPoints;
+        std::vector<HitObject> HitObjects;
+        std::vector<Event> Events; // Other events are dropped
+        // Keeps the capacity of every array
+        void Clear() {
+            AudioFilename = ArtistUnicode = TitleUnicode = std::string_view();
+            AudioLeadIn = 0;
+            KeyCount = 0;
+            TimingPoints.clear();
+            HitObjects.clear();
+            Events.clear();
+        }
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_CHART_HPP_INCLUDED
@@ -0,0 +1,265 @@
+#include "O2BChartParser.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+namespace Osu2Bms {
+
+    namespace {
+
+        std::string_view Trim(std::string_view s) {
+            const char *blanks = " \t\r";
+            auto begin = s.find_first_not_of(blanks);
+            if (begin == std::string_view::npos) {
+                return std::string_view();
+            }
+            return s.substr(begin, s.find_last_not_of(blanks) - begin + 1);
+        }
+
+        // Splits off the text before the first separator
+        std::string_view NextField(std::string_view &rest, char separator) {
+            auto end = rest.find(separator);
+            auto field = rest.substr(0, end);
+            rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 1);
+            return field;
+        }
+
+        std::string_view Unquote(std::string_view s) {
+            if (s.size() >= 2 && s.front() == '"' && s.back() == '"') {
+                return s.substr(1, s.size() - 2);
+            }
+            return s;
+        }
+
+        bool StartsWith(std::string_view s, std::string_view prefix) {
+            return s.substr(0, prefix.size()) == prefix;
+        }
+
+    }
+
+    O2BChart O2BChartParser::operator()(std::string_view text) {
+        O2BChart chart;
+        (*this)(text, chart);
+        return chart;
+    }
+
+    void O2BChartParser::operator()(std::string_view text, O2BChart &chart) {
+        chart.Clear();
+        _LineNumber = 0;
+        _HasMode = false;
+        if (StartsWith(text, "\xEF\xBB\xBF")) {
+            text.remove_prefix(3);
+        }
+        auto section = _Section::None;
+        bool hasHeader = false;
+        while (!text.empty()) {
+            auto raw = NextField(text, '\n');
+            ++_LineNumber;
+            auto line = Trim(raw);
+            if (line.empty() || StartsWith(line, "//")) {
+                continue;
+            }
+            if (!hasHeader) {
+                if (!StartsWith(line, "osu file format v")) {
+                    _Fail("Not an osu! beatmap");
+                }
+                hasHeader = true;
+                continue;
+            }
+            if (line.front() == '[' && line.back() == ']') {
+                section = _SectionOf(line.substr(1, line.size() - 2));
+                continue;
+            }
+            switch (section) {
+            case _Section::General:
+            case _Section::Metadata:
+            case _Section::Difficulty:
+                _ParseKeyValue(section, line, chart);
+                break;
+            case _Section::Events:
+                // Indented lines are storyboard commands
+                if (raw.front() != ' ' && raw.front() != '_') {
+                    _ParseEvent(line, chart);
+                }
+                break;
+            case _Section::TimingPoints:
+                _ParseTimingPoint(line, chart);
+                break;
+            case _Section::HitObjects:
+                _ParseHitObject(line, chart);
+                break;
+            default:
+                break;
+            }
+        }
+        if (!hasHeader) {
+            _Fail("Not an osu! beatmap");
+        }
+        // Charts without a mode are osu!standard
+        if (!_HasMode) {
+            throw O2BException("Not an osu!mania beatmap");
+        }
+    }
+
+    O2BChartParser::_Section O2BChartParser::_SectionOf(std::string_view name) {
+        if (name == "General") {
+            return _Section::General;
+        } else if (name == "Metadata") {
+            return _Section::Metadata;
+        } else if (name == "Difficulty") {
+            return _Section::Difficulty;
+        } else if (name == "Events") {
+            return _Section::Events;
+        } else if (name == "TimingPoints") {
+            return _Section::TimingPoints;
+        } else if (name == "HitObjects") {
+            return _Section::HitObjects;
+        }
+        return _Section::Other;
+    }
+
+    void O2BChartParser::_ParseKeyValue(_Section section, std::string_view line, O2BChart &chart) {
+        auto key = Trim(NextField(line, ':'));
+        auto value = Trim(line);
+        switch (section) {
+        case _Section::General:
+            if (key == "AudioFilename") {
+                chart.AudioFilename = value;
+            } else if (key == "AudioLeadIn") {
+                chart.AudioLeadIn = _ParseInt(value);
+            } else if (key == "Mode") {
+                if (_ParseInt(value) != 3) {
+                    _Fail("Not an osu!mania beatmap");
+                }
+                _HasMode = true;
+            }
+            break;
+        case _Section::Metadata:
+            if (key == "TitleUnicode") {
+                chart.TitleUnicode = value;
+            } else if (key == "ArtistUnicode") {
+                chart.ArtistUnicode = value;
+            }
+            break;
+        case _Section::Difficulty:
+            // osu!mania keeps the key count in CircleSize
+            if (key == "CircleSize") {
+                auto keyCount = _ParseDouble(value);
+                if (keyCount < 1 || keyCount > 18) {
+                    _Fail("Key count out of range [1, 18]");
+                }
+                chart.KeyCount = static_cast<uint8_t>(keyCount);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Background and Video: type,time,"file",...
+    // Sample: Sample,time,layer,"file",volume
+    void O2BChartParser::_ParseEvent(std::string_view line, O2BChart &chart) {
+        auto type = Trim(NextField(line, ','));
+        O2BChart::Event event;
+        if (type == "0" || type == "Background") {
+            event.Type = O2BChart::EventType::Background;
+        } else if (type == "1" || type == "Video") {
+            event.Type = O2BChart::EventType::Video;
+        } else if (type == "5" || type == "Sample") {
+            event.Type = O2BChart::EventType::SoundEffect;
+        } else {
+            return;
+        }
+        event.Time = _ParseInt(Trim(NextField(line, ',')));
+        if (event.Type == O2BChart::EventType::SoundEffect) {
+            NextField(line, ',');
+        }
+        event.FilePath = Unquote(Trim(NextField(line, ',')));
+        chart.Events.push_back(event);
+    }
+
+    // time,beatLength,meter,sampleSet,sampleIndex,volume,uninherited,effects
+    // Old formats stop after beatLength or volume; a negative beat length
+    // then marks an inherited point.
+    void O2BChartParser::_ParseTimingPoint(std::string_view line, O2BChart &chart) {
+        O2BChart::TimingPoint tp;
+        tp.Time = _ParseInt(Trim(NextField(line, ',')));
+        auto beatLength = _ParseDouble(Trim(NextField(line, ',')));
+        tp.Meter = 4;
+        tp.Inherited = beatLength < 0;
+        if (!line.empty()) {
+            auto meter = _ParseInt(Trim(NextField(line, ',')));
+            // Old ranked maps have meter 0, which osu! plays as 4/4
+            if (meter <= 0) {
+                meter = 4;
+            }
+            if (meter > 255) {
+                _Fail("Meter out of range [1, 255]");
+            }
+            tp.Meter = static_cast<uint8_t>(meter);
+        }
+        for (int i = 0; i < 3; ++i) {
+            NextField(line, ',');
+        }
+        auto uninherited = Trim(NextField(line, ','));
+        if (!uninherited.empty()) {
+            tp.Inherited = _ParseInt(uninherited) == 0;
+        }
+        tp.BeatsPerMinute = 60000 / beatLength;
+        tp.Ratio = -beatLength / 100;
+        chart.TimingPoints.push_back(tp);
+    }
+
+    // x,y,time,type,hitSound,hitSample for notes and
+    // x,y,time,type,hitSound,endTime:hitSample for holds, where hitSample is
+    // normalSet:additionSet:index:volume:filename
+    void O2BChartParser::_ParseHitObject(std::string_view line, O2BChart &chart) {
+        if (chart.KeyCount == 0) {
+            _Fail("HitObjects appear before the key count");
+        }
+        O2BChart::HitObject object;
+        auto x = _ParseInt(Trim(NextField(line, ',')));
+        NextField(line, ',');
+        object.StartTime = _ParseInt(Trim(NextField(line, ',')));
+        auto type = _ParseInt(Trim(NextField(line, ',')));
+        NextField(line, ',');
+        object.IsHold = (type & 128) != 0;
+        object.EndTime = object.IsHold ? _ParseInt(Trim(NextField(line, ':'))) : object.StartTime;
+        for (int i = 0; i < 4 && !line.empty(); ++i) {
+            NextField(line, ':');
+        }
+        object.HitSound = Trim(line);
+        auto column = static_cast<int64_t>(x) * chart.KeyCount / 512;
+        object.Column = static_cast<uint8_t>(std::min<int64_t>(std::max<int64_t>(column, 0), chart.KeyCount - 1));
+        chart.HitObjects.push_back(object);
+    }
+
+    // Newer clients write some times with a fractional part, which is dropped
+    int32_t O2BChartParser::_ParseInt(std::string_view field) {
+        int32_t value = 0;
+        auto end = field.data() + field.size();
+        auto result = std::from_chars(field.data(), end, value);
+        if (result.ec != std::errc() || (result.ptr != end && *result.ptr != '.')) {
+            _Fail("Invalid integer \"" + std::string(field) + "\"");
+        }
+        if (result.ptr != end) {
+            return static_cast<int32_t>(_ParseDouble(field));
+        }
+        return value;
+    }
+
+    double O2BChartParser::_ParseDouble(std::string_view field) {
+        double value = 0;
+        auto end = field.data() + field.size();
+        auto result = std::from_chars(field.data(), end, value);
+        if (result.ec != std::errc() || result.ptr != end) {
+            _Fail("Invalid number \"" + std::string(field) + "\"");
+        }
+        return value;
+    }
+
+    void O2BChartParser::_Fail(const std::string &message) {
+        throw O2BException("Line " + std::to_string(_LineNumber) + ": " + message);
+    }
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_CHART_PARSER_HPP_INCLUDED
+#define OSU_2_BMS_O2B_CHART_PARSER_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "O2BChart.hpp"
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // Reads the fields O2BConverter needs straight out of .osu text, usually
+    // an O2BMappedFile. Lines and fields are string_views into the text and
+    // numbers are read with std::from_chars, so nothing is copied; the chart's
+    // strings point into the text.
+    // Lines are numbered in error messages. Only osu!mania charts (Mode: 3)
+    // are accepted, as the converter would misread the others' hit objects.
+    class O2BChartParser {
+    public:
+        // Fills chart, reusing its arrays
+        void operator()(std::string_view text, O2BChart &chart);
+        O2BChart operator()(std::string_view text);
+    private:
+        enum class _Section : uint8_t {
+            None,
+            General,
+            Metadata,
+            Difficulty,
+            Events,
+            TimingPoints,
+            HitObjects,
+            Other
+        };
+        size_t _LineNumber = 0;
+        bool _HasMode = false;
+    private:
+        static _Section _SectionOf(std::string_view name);
+        void _ParseKeyValue(_Section section, std::string_view line, O2BChart &chart);
+        void _ParseEvent(std::string_view line, O2BChart &chart);
+        void _ParseTimingPoint(std::string_view line, O2BChart &chart);
+        void _ParseHitObject(std::string_view line, O2BChart &chart);
+        int32_t _ParseInt(std::string_view field);
+        double _ParseDouble(std::string_view field);
+        [[noreturn]] void _Fail(const std::string &message);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_CHART_PARSER_HPP_INCLUDED
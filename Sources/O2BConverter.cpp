@@ -1,350 +1,1154 @@
 #include "O2BConverter.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <vector>
 
+#include "_Detail/AllocationCounter.hpp"
+#include "_Detail/RadixSort.hpp"
 #include "_Detail/Utilities.hpp"
 
 namespace Osu2Bms {
 
-    O2BConverter::O2BConverter(const O2BConvertionOptions &options)
-        : _Options(options) {}
+    O2BConverter::O2BConverter(const O2BConvertionOptions &options, O2BThreadPool *sectionPool)
+        : _Options(options), _ColumnChannels(_MakeColumnChannels(options.KeyMap)), _SectionPool(sectionPool) {}
 
-    Bms::BmsBeatmap O2BConverter::operator()(const Osu::OsuBeatmap &osuBeatmap) throw(O2BException) {
+    std::vector<Bms::BmsChannelId> O2BConverter::_MakeColumnChannels(const std::vector<Bms::BmsChannelId> &keyMap) {
         using namespace std;
-        cout << "Generating BPMs..." << endl;
-        auto bpms = _GenerateBpms(osuBeatmap);
-        cout << "Generating WAVs..." << endl;
-        auto wavs = _GenerateWavs(osuBeatmap);
-        cout << "Generating BMPs..." << endl;
-        auto bmps = _GenerateBmps(osuBeatmap);
-        cout << "Generating notes..." << endl;
-        auto notes = _GenerateNotes(osuBeatmap, bpms, wavs, bmps);
-        cout << "Converting time to position..." << endl;
-        _ConvertTimeToPosition(osuBeatmap, notes, bpms);
-        cout << "Generating BMS beatmap..." << endl;
-        return _GenerateBmsBeatmap(osuBeatmap, notes, bpms, wavs, bmps);
-    }
-
-    std::vector<double> O2BConverter::_GenerateBpms(
-        const Osu::OsuBeatmap &osuBeatmap) {
-        using namespace std;
-        vector<double> bpms;
-        if (_Options.WithTimingPoints) {
-            if (osuBeatmap.TimingPoints.size() == 0 || osuBeatmap.TimingPoints.front().Inherited) {
-                throw O2BException(
-                    std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
-                    + ": First TimingPoint should be non-inherited");
+        using namespace Bms;
+        vector<BmsChannelId> channels;
+        channels.reserve(2 * keyMap.size());
+        for (auto channel : keyMap) {
+            channels.push_back(channel);
+            channels.push_back(static_cast<BmsChannelId>(
+                static_cast<underlying_type_t<BmsChannelId>>(channel) + 40));
+        }
+        return channels;
+    }
+
+    const O2BConvertionOptions &O2BConverter::Options() const {
+        return _Options;
+    }
+
+    // Feeds the sorted notes [begin, end) into a section buffer and hands every
+    // finished section to emit(section, buffer) before the buffer is reset.
+    // The range starts at a section boundary.
+    template <typename Emit>
+    void O2BConverter::_GenerateSections(
+        const _NoteBuffer &notes, size_t begin, size_t end, _SectionBuffer &buffer, Emit emit) const {
+        using namespace Bms;
+        uint16_t section = begin == 0 ? 0 : notes.Sections[begin];
+        for (size_t i = begin; i < end; ++i) {
+            auto channel = notes.Channels[i];
+            auto ref = notes.ReferenceIds[i];
+            uint16_t noteSection = notes.Sections[i];
+            if (noteSection != section) {
+                ++buffer.SectionCount;
+                emit(section, buffer);
+                buffer.Reset();
+                section = noteSection;
             }
-            double last = nan(nullptr);
-            for (const auto &tp : osuBeatmap.TimingPoints) {
-                if (!tp.Inherited || _Options.WithInheritedTimingPoints) {
-                    double bpm = last;
-                    if (tp.Inherited) {
-                        bpm /= tp.Ratio();
-                    } else {
-                        last = bpm = tp.BeatsPerMinute();
-                    }
-                    auto it = lower_bound(bpms.begin(), bpms.end(), bpm);
-                    if (it == bpms.end() || *it != bpm) {
-                        bpms.insert(it, bpm);
-                    }
-                }
+            uint8_t index = notes.Indices[i];
+            if (channel == BmsChannelId::Bgm) {
+                buffer.PutBgm(index, ref, notes.Fractions[i], notes.Slopes[i]);
+            } else {
+                buffer.Put(channel, index, ref, notes.Fractions[i], notes.Slopes[i]);
             }
         }
-        return bpms;
+        ++buffer.SectionCount;
+        emit(section, buffer);
     }
 
-    std::vector<std::string> O2BConverter::_GenerateWavs(
-        const Osu::OsuBeatmap &osuBeatmap) {
+    // Chunks end at section boundaries near equal shares of the notes, so
+    // that each is at least _MinChunkSections long on average
+    bool O2BConverter::_SplitSections(const _NoteBuffer &notes, std::vector<_SectionChunk> &chunks) const {
         using namespace std;
-        vector<string> wavs;
-        auto addWav = [&wavs](const std::string &wav) {
-            auto it = lower_bound(wavs.begin(), wavs.end(), wav);
-            if (it == wavs.end() || *it != wav) {
-                wavs.insert(it, wav);
+        const size_t n = notes.Size();
+        if (_SectionPool == nullptr || _SectionPool->ThreadCount() < 2
+            || n == 0 || notes.Sections.back() < _MinParallelSections) {
+            return false;
+        }
+        // A few chunks per thread even out sections of different density
+        const size_t target = min<size_t>(4 * (_SectionPool->ThreadCount() + 1),
+            notes.Sections.back() / _MinChunkSections);
+        chunks.resize(target);
+        size_t count = 0;
+        size_t begin = 0;
+        for (size_t k = 1; k <= target && begin < n; ++k) {
+            size_t end = k == target ? n : max(begin + 1, k * n / target);
+            while (end < n && notes.Sections[end] == notes.Sections[end - 1]) {
+                ++end;
             }
+            chunks[count].Begin = begin;
+            chunks[count].End = end;
+            ++count;
+            begin = end;
+        }
+        chunks.resize(count);
+        return count > 1;
+    }
+
+    // Workers and the calling thread take chunks in turn until none are left,
+    // so the caller never waits for a chunk nobody is working on. Workers
+    // which start after every chunk is taken return without touching them.
+    template <typename Process>
+    void O2BConverter::_RunChunks(std::vector<_SectionChunk> &chunks, _SectionBuffer &buffer, Process process) const {
+        using namespace std;
+        struct Job {
+            atomic<size_t> Next{ 0 };
+            size_t Count = 0;
+            size_t Done = 0;
+            mutex Mutex;
+            condition_variable AllDone;
         };
-        addWav(osuBeatmap.AudioFilename);
-        if (_Options.WithKeySounds) {
-            for (auto &object : osuBeatmap.HitObjects) {
-                auto wav = object->StartPoint.CustomHitSound;
-                if (wav) {
-                    addWav(*wav);
+        auto job = make_shared<Job>();
+        job->Count = chunks.size();
+        auto *data = chunks.data();
+        const uint8_t gridSize = _Options.GridSize;
+        auto run = [job, data, gridSize, process] {
+            for (size_t k; (k = job->Next++) < job->Count;) {
+                auto &chunk = data[k];
+                auto &buffer = _ThreadScratch().Sections;
+                chunk.Error = nullptr;
+                try {
+                    buffer.Clear(gridSize);
+                    process(chunk, buffer);
+                    chunk.Stats = buffer.Stats;
+                    chunk.SectionCount = buffer.SectionCount;
+                } catch (...) {
+                    chunk.Error = current_exception();
+                }
+                lock_guard<mutex> lock(job->Mutex);
+                if (++job->Done == job->Count) {
+                    job->AllDone.notify_all();
                 }
             }
+        };
+        auto helpers = min(_SectionPool->ThreadCount(), chunks.size() - 1);
+        for (size_t i = 0; i < helpers; ++i) {
+            _SectionPool->Submit(run);
         }
-        if (_Options.WithEventSounds) {
-            for (auto &event : osuBeatmap.Events) {
-                if (std::dynamic_pointer_cast<Osu::OsuSoundEffectEvent>(event)) {
-                    addWav(event->FilePath);
+        run();
+        {
+            unique_lock<mutex> lock(job->Mutex);
+            job->AllDone.wait(lock, [&job] {
+                return job->Done == job->Count;
+            });
+        }
+        buffer.Stats = _QuantizationStats();
+        buffer.SectionCount = 0;
+        for (const auto &chunk : chunks) {
+            if (chunk.Error) {
+                rethrow_exception(chunk.Error);
+            }
+            buffer.Stats.MaxError = max(buffer.Stats.MaxError, chunk.Stats.MaxError);
+            buffer.Stats.ErrorSum += chunk.Stats.ErrorSum;
+            buffer.Stats.ErrorCount += chunk.Stats.ErrorCount;
+            buffer.Stats.OffGridCount += chunk.Stats.OffGridCount;
+            buffer.SectionCount += chunk.SectionCount;
+        }
+    }
+
+    // A #WAV redefinition is written right before the first section at or
+    // after the one it belongs to
+    void O2BConverter::_WriteSections(
+        O2BBmsWriter &writer,
+        const _NoteBuffer &notes,
+        size_t begin,
+        size_t end,
+        const _ResourceTables &tables,
+        const _WavAssignment &wavIds,
+        size_t nextDefinition,
+        _SectionBuffer &buffer) const {
+        const auto &definitions = wavIds.Definitions;
+        _GenerateSections(notes, begin, end, buffer, [&](uint16_t section, _SectionBuffer &buffer) {
+            for (; nextDefinition < definitions.size() && definitions[nextDefinition].Section <= section; ++nextDefinition) {
+                const auto &definition = definitions[nextDefinition];
+                if (!definition.Initial) {
+                    writer.WriteDefinition("WAV", definition.Id, tables.WavTable().Value(definition.Wav));
                 }
             }
+            _WriteSectionData(writer, section, buffer);
+        });
+    }
+
+    Bms::BmsBeatmap O2BConverter::operator()(
+        const Osu::OsuBeatmap &osuBeatmap,
+        O2BConvertionReport *report) const {
+        auto &chart = _ThreadScratch().Chart;
+        _Lower(osuBeatmap, chart);
+        return (*this)(chart, report);
+    }
+
+    void O2BConverter::operator()(
+        const Osu::OsuBeatmap &osuBeatmap,
+        std::ostream &out,
+        O2BConvertionReport *report) const {
+        auto &chart = _ThreadScratch().Chart;
+        _Lower(osuBeatmap, chart);
+        (*this)(chart, out, report);
+    }
+
+    Bms::BmsBeatmap O2BConverter::operator()(
+        const O2BChart &chart,
+        O2BConvertionReport *report) const {
+        return _Convert(chart, nullptr, report);
+    }
+
+    void O2BConverter::operator()(
+        const O2BChart &chart,
+        std::ostream &out,
+        O2BConvertionReport *report) const {
+        _Convert(chart, nullptr, out, report);
+    }
+
+    Bms::BmsBeatmap O2BConverter::operator()(
+        const O2BChart &chart,
+        const O2BResourceIndex &resources,
+        O2BConvertionReport *report) const {
+        return _Convert(chart, &resources, report);
+    }
+
+    void O2BConverter::operator()(
+        const O2BChart &chart,
+        const O2BResourceIndex &resources,
+        std::ostream &out,
+        O2BConvertionReport *report) const {
+        _Convert(chart, &resources, out, report);
+    }
+
+    Bms::BmsBeatmap O2BConverter::_Convert(
+        const O2BChart &chart,
+        const O2BResourceIndex *shared,
+        O2BConvertionReport *report) const {
+        auto &scratch = _ThreadScratch();
+        _StageProfile profile;
+        _PrepareNotes(chart, shared, scratch, profile);
+        return _GenerateBmsBeatmap(chart, scratch, profile, report);
+    }
+
+    void O2BConverter::_Convert(
+        const O2BChart &chart,
+        const O2BResourceIndex *shared,
+        std::ostream &out,
+        O2BConvertionReport *report) const {
+        auto &scratch = _ThreadScratch();
+        const auto &notes = scratch.Notes;
+        const auto &tables = scratch.Tables;
+        auto &buffer = scratch.Sections;
+        _StageProfile profile;
+        _PrepareNotes(chart, shared, scratch, profile);
+        _StageMeter meter;
+        const auto &wavIds = scratch.WavIds;
+        _AssignReferenceIds(scratch, _Options.ReferenceBase, _Options.WithWavRedefinition);
+        O2BBmsWriter writer(out, scratch.Line);
+        _WriteHeader(writer, chart, tables, wavIds);
+        writer.BeginMainData();
+        auto &chunks = scratch.Chunks;
+        if (_SplitSections(notes, chunks)) {
+            const auto &definitions = wavIds.Definitions;
+            for (size_t k = 0; k < chunks.size(); ++k) {
+                auto &chunk = chunks[k];
+                chunk.FirstDefinition = 0;
+                if (k > 0) {
+                    auto previous = notes.Sections[chunk.Begin - 1];
+                    chunk.FirstDefinition = static_cast<size_t>(std::upper_bound(
+                        definitions.begin(), definitions.end(), previous,
+                        [](uint16_t section, const _WavAssignment::Definition &definition) {
+                            return section < definition.Section;
+                        }) - definitions.begin());
+                }
+            }
+            _RunChunks(chunks, buffer, [&](_SectionChunk &chunk, _SectionBuffer &buffer) {
+                std::ostringstream text;
+                O2BBmsWriter chunkWriter(text, chunk.Line);
+                chunkWriter.SetBase(_Options.ReferenceBase);
+                _WriteSections(chunkWriter, notes, chunk.Begin, chunk.End, tables, wavIds, chunk.FirstDefinition, buffer);
+                chunk.Text = text.str();
+            });
+            for (const auto &chunk : chunks) {
+                out.write(chunk.Text.data(), static_cast<std::streamsize>(chunk.Text.size()));
+            }
+        } else {
+            buffer.Clear(_Options.GridSize);
+            _WriteSections(writer, notes, 0, notes.Size(), tables, wavIds, 0, buffer);
+        }
+        writer.Flush();
+        meter.Record(profile.GenerateBeatmap);
+        _FillReport(notes, tables, wavIds, buffer, profile, report);
+    }
+
+    void O2BConverter::_PrepareNotes(
+        const O2BChart &chart,
+        const O2BResourceIndex *shared,
+        _Scratch &scratch,
+        _StageProfile &profile) const {
+        auto &notes = scratch.Notes;
+        auto &tables = scratch.Tables;
+        _StageMeter meter;
+        _GenerateNotes(chart, shared, notes, tables);
+        meter.Record(profile.GenerateNotes);
+        _SortNotes(scratch);
+        meter.Record(profile.SortNotes);
+        _BuildTempoMap(chart, notes, tables.Bpms, scratch.TempoMap);
+        _ConvertTimeToPosition(notes, scratch.TempoMap);
+        meter.Record(profile.ConvertTimeToPosition);
+        _QuantizePositions(notes);
+        meter.Record(profile.QuantizePositions);
+    }
+
+    // Thread-local rather than a member, so that a shared converter needs no locking
+    O2BConverter::_Scratch &O2BConverter::_ThreadScratch() {
+        static thread_local _Scratch scratch;
+        return scratch;
+    }
+
+    O2BConverter::_StageMeter::_StageMeter()
+        : _Allocations(_Detail::AllocationCount()) {}
+
+    void O2BConverter::_StageMeter::Record(O2BConvertionReport::Stage &stage) {
+        auto allocations = _Detail::AllocationCount();
+        stage.Milliseconds = _Stopwatch.Lap();
+        stage.Allocations = allocations - _Allocations;
+        _Allocations = allocations;
+    }
+
+    // Only views into osuBeatmap are taken, so nothing but the arrays is copied
+    void O2BConverter::_Lower(const Osu::OsuBeatmap &osuBeatmap, O2BChart &chart) {
+        using namespace Osu;
+        chart.Clear();
+        chart.AudioFilename = osuBeatmap.AudioFilename;
+        chart.AudioLeadIn = osuBeatmap.AudioLeadIn;
+        chart.ArtistUnicode = osuBeatmap.ArtistUnicode;
+        chart.TitleUnicode = osuBeatmap.TitleUnicode;
+        chart.KeyCount = osuBeatmap.ManiaKeyCount();
+        chart.TimingPoints.reserve(osuBeatmap.TimingPoints.size());
+        for (const auto &tp : osuBeatmap.TimingPoints) {
+            chart.TimingPoints.push_back({
+                tp.Time,
+                tp.Inherited ? 0 : tp.BeatsPerMinute(),
+                tp.Inherited ? tp.Ratio() : 0,
+                tp.Meter,
+                tp.Inherited });
+        }
+        for (const auto &pointer : osuBeatmap.Events) {
+            const auto &event = *pointer;
+            const auto &type = typeid(event);
+            if (type == typeid(OsuSoundEffectEvent)) {
+                chart.Events.push_back({ O2BChart::EventType::SoundEffect,
+                    static_cast<const OsuSoundEffectEvent &>(event).Time, event.FilePath });
+            } else if (type == typeid(OsuVideoEvent)) {
+                chart.Events.push_back({ O2BChart::EventType::Video,
+                    static_cast<const OsuVideoEvent &>(event).Time, event.FilePath });
+            } else if (type == typeid(OsuBackgroundEvent)) {
+                chart.Events.push_back({ O2BChart::EventType::Background,
+                    static_cast<const OsuBackgroundEvent &>(event).Time, event.FilePath });
+            }
         }
-        return wavs;
+        chart.HitObjects.reserve(osuBeatmap.HitObjects.size());
+        for (const auto &pointer : osuBeatmap.HitObjects) {
+            const auto &o = *pointer;
+            O2BChart::HitObject object;
+            object.StartTime = o.StartTime;
+            object.IsHold = typeid(o) == typeid(OsuHold);
+            object.EndTime = object.IsHold ? static_cast<const OsuHold &>(o).EndTime : o.StartTime;
+            object.Column = o.StartPoint.ManiaColumn(chart.KeyCount);
+            if (const auto &wav = o.StartPoint.CustomHitSound) {
+                object.HitSound = *wav;
+            }
+            chart.HitObjects.push_back(object);
+        }
+    }
+
+    void O2BConverter::_NoteBuffer::Reserve(size_t n) {
+        Times.reserve(n);
+        Positions.reserve(n);
+        Channels.reserve(n);
+        ReferenceIds.reserve(n);
+        ObjectIndices.reserve(n);
+        Slopes.reserve(n);
+        Sections.reserve(n);
+        Indices.reserve(n);
+        Fractions.reserve(n);
+    }
+
+    // Keeps the capacity of every array
+    void O2BConverter::_NoteBuffer::Clear() {
+        Times.clear();
+        Positions.clear();
+        Channels.clear();
+        ReferenceIds.clear();
+        ObjectIndices.clear();
+        Slopes.clear();
+        Sections.clear();
+        Indices.clear();
+        Fractions.clear();
+    }
+
+    void O2BConverter::_ResourceTables::Clear() {
+        Bpms.Clear();
+        BpmChanges.Candidates.clear();
+        BpmChanges.Kept.clear();
+        BpmChanges.RawBpms.Clear();
+        Wavs.Clear();
+        Bmps.Clear();
+        Shared = nullptr;
+        Cover.clear();
+    }
+
+    const O2BConverter::_PathTable &O2BConverter::_ResourceTables::WavTable() const {
+        return Shared != nullptr ? Shared->Wavs() : Wavs;
+    }
+
+    const O2BConverter::_PathTable &O2BConverter::_ResourceTables::BmpTable() const {
+        return Shared != nullptr ? Shared->Bmps() : Bmps;
     }
 
-    std::vector<std::string> O2BConverter::_GenerateBmps(
-        const Osu::OsuBeatmap &osuBeatmap) {
+    void O2BConverter::_NoteBuffer::PushBack(
+        int32_t time, Bms::BmsChannelId channel, size_t referenceId, size_t objectIndex) {
+        // Provisional IDs index a BPM, WAV or BMP table, which may outgrow 16 bits
+        if (referenceId > std::numeric_limits<uint16_t>::max()) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": More than " + std::to_string(std::numeric_limits<uint16_t>::max())
+                + " distinct BPM values, samples or images");
+        }
+        Times.push_back(time);
+        Channels.push_back(channel);
+        ReferenceIds.push_back(static_cast<uint16_t>(referenceId));
+        ObjectIndices.push_back(static_cast<uint32_t>(objectIndex));
+    }
+
+    size_t O2BConverter::_NoteBuffer::Size() const {
+        return Times.size();
+    }
+
+    // Positions are computed from the BPM values written, so dropping or
+    // snapping a change keeps every note's time and only changes how fast
+    // the notes scroll until the next change. A change superseded at the
+    // same time, or which leaves both the BPM and the meter as they were, is
+    // always dropped. With MaxBpmCount the snapping step is doubled until
+    // the distinct values fit.
+    void O2BConverter::_CoalesceBpmChanges(const O2BChart &chart, _ResourceTables &tables) const {
         using namespace std;
-        vector<string> bmps;
-        if (_Options.WithBga) {
-            for (auto &event : osuBeatmap.Events) {
-                if (std::dynamic_pointer_cast<Osu::OsuVideoEvent>(event)) {
-                    const auto &bmp = event->FilePath;
-                    auto it = lower_bound(bmps.begin(), bmps.end(), bmp);
-                    if (it == bmps.end() || *it != bmp) {
-                        bmps.insert(it, bmp);
-                    }
+        auto &changes = tables.BpmChanges;
+        double last = numeric_limits<double>::quiet_NaN();
+        for (size_t i = 0; i < chart.TimingPoints.size(); ++i) {
+            const auto &tp = chart.TimingPoints[i];
+            if (!tp.Inherited || _Options.WithInheritedTimingPoints) {
+                double bpm = last;
+                if (tp.Inherited) {
+                    bpm /= tp.Ratio;
+                } else {
+                    last = bpm = tp.BeatsPerMinute;
                 }
+                changes.Candidates.push_back({ tp.Time, static_cast<uint32_t>(i), tp.Meter, bpm });
+                changes.RawBpms.Insert(bpm);
             }
         }
-        return bmps;
+        // Snapped values are the header BPM times a whole power of the step
+        const double anchor = chart.TimingPoints.front().BeatsPerMinute;
+        const double tolerance = _Options.BpmTolerance;
+        double step = tolerance > 0 ? log1p(tolerance) : 0;
+        for (;;) {
+            auto &kept = changes.Kept;
+            kept.clear();
+            for (auto change : changes.Candidates) {
+                if (step > 0) {
+                    change.Bpm = anchor * exp(round(log(change.Bpm / anchor) / step) * step);
+                }
+                if (!kept.empty() && kept.back().Time == change.Time) {
+                    kept.pop_back();
+                }
+                if (!kept.empty() && kept.back().Meter == change.Meter
+                    && fabs(change.Bpm / kept.back().Bpm - 1) <= max(tolerance, expm1(step))) {
+                    continue;
+                }
+                kept.push_back(change);
+            }
+            if (_Options.MaxBpmCount == 0) {
+                break;
+            }
+            tables.Bpms.Clear();
+            for (const auto &change : kept) {
+                tables.Bpms.Insert(change.Bpm);
+            }
+            if (tables.Bpms.Size() <= _Options.MaxBpmCount) {
+                break;
+            }
+            step = step > 0 ? step * 2 : 1.0 / 1024;
+        }
+        // The caller interns the kept values again alongside the Bpm2 notes
+        tables.Bpms.Clear();
     }
 
-    std::vector<O2BConverter::_Note> O2BConverter::_GenerateNotes(
-        const Osu::OsuBeatmap &osuBeatmap,
-        const std::vector<double> &bpms,
-        const std::vector<std::string> &wavs,
-        const std::vector<std::string> &bmps) {
+    // Walks TimingPoints, Events and HitObjects once each. Resources are interned
+    // while the notes are emitted, so notes carry provisional IDs until the
+    // tables are finalized and the IDs are remapped at the end. Files in a
+    // shared index already have their final IDs.
+    void O2BConverter::_GenerateNotes(
+        const O2BChart &chart,
+        const O2BResourceIndex *shared,
+        _NoteBuffer &notes,
+        _ResourceTables &tables) const {
         using namespace std;
         using namespace Bms;
-        using namespace Osu;
-        vector<_Note> notes;
-        double last = nan(nullptr);
+        notes.Clear();
+        tables.Clear();
+        tables.Shared = shared;
+        auto wavId = [&](string_view path) {
+            return shared != nullptr ? shared->WavId(path) : tables.Wavs.Insert(path);
+        };
+        auto bmpId = [&](string_view path) {
+            return shared != nullptr ? shared->BmpId(path) : tables.Bmps.Insert(path);
+        };
+        // Upper bound: every hold contributes two notes
+        notes.Reserve(chart.TimingPoints.size() + 1
+            + chart.Events.size() + 2 * chart.HitObjects.size());
         if (_Options.WithTimingPoints) {
-            for (size_t i = 0; i < osuBeatmap.TimingPoints.size(); ++i) {
-                const auto &tp = osuBeatmap.TimingPoints[i];
-                if (!tp.Inherited || _Options.WithInheritedTimingPoints) {
-                    double bpm = last;
-                    if (tp.Inherited) {
-                        bpm /= tp.Ratio();
-                    } else {
-                        last = bpm = tp.BeatsPerMinute();
-                    }
-                    _Note note;
-                    note.Channel = BmsChannelId::Bpm2;
-                    note.ReferenceId =
-                        lower_bound(bpms.begin(), bpms.end(), bpm)
-                        - bpms.begin() + 1;
-                    note.Time = tp.Time;
-                    note.AssociatedObjectType = _Note::TimingPoint;
-                    note.AssociatedObjectIndex = i;
-                    notes.push_back(note);
-                }
+            if (chart.TimingPoints.size() == 0 || chart.TimingPoints.front().Inherited) {
+                throw O2BException(
+                    std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                    + ": First TimingPoint should be non-inherited");
+            }
+            _CoalesceBpmChanges(chart, tables);
+            for (const auto &change : tables.BpmChanges.Kept) {
+                notes.PushBack(change.Time, BmsChannelId::Bpm2, tables.Bpms.Insert(change.Bpm), change.TimingPoint);
             }
         }
-        _Note bgmNote;
-        bgmNote.Time = osuBeatmap.AudioLeadIn;
-        bgmNote.Channel = BmsChannelId::Bgm;
-        bgmNote.ReferenceId = lower_bound(wavs.begin(), wavs.end(), osuBeatmap.AudioFilename) - wavs.begin() + 1;
-        notes.push_back(bgmNote);
-        for (size_t i = 0; i < osuBeatmap.Events.size(); ++i) {
-            const auto &event = osuBeatmap.Events[i];
-            string fileName = event->FilePath;
-            if (auto sound = dynamic_pointer_cast<OsuSoundEffectEvent>(event)) {
+        auto audioWav = wavId(chart.AudioFilename);
+        notes.PushBack(chart.AudioLeadIn, BmsChannelId::Bgm, audioWav);
+        bool hasCover = false;
+        for (size_t i = 0; i < chart.Events.size(); ++i) {
+            const auto &event = chart.Events[i];
+            switch (event.Type) {
+            case O2BChart::EventType::SoundEffect:
                 if (_Options.WithEventSounds) {
-                    _Note note;
-                    note.Time = sound->Time;
-                    note.Channel = BmsChannelId::Bgm;
-                    note.ReferenceId = lower_bound(wavs.begin(), wavs.end(), fileName) - wavs.begin() + 1;
-                    note.AssociatedObjectType = _Note::Event;
-                    note.AssociatedObjectIndex = i;
-                    notes.push_back(note);
+                    notes.PushBack(event.Time, BmsChannelId::Bgm, wavId(event.FilePath), i);
                 }
-            } else if (auto video = dynamic_pointer_cast<OsuVideoEvent>(event)) {
+                break;
+            case O2BChart::EventType::Video:
                 if (_Options.WithBga) {
-                    _Note note;
-                    note.Time = video->Time;
-                    note.Channel = BmsChannelId::Bga;
-                    note.ReferenceId = lower_bound(bmps.begin(), bmps.end(), fileName) - bmps.begin() + 1;
-                    note.AssociatedObjectType = _Note::Event;
-                    note.AssociatedObjectIndex = i;
-                    notes.push_back(note);
+                    notes.PushBack(event.Time, BmsChannelId::Bga, bmpId(event.FilePath), i);
+                }
+                break;
+            case O2BChart::EventType::Background:
+                if (!hasCover) {
+                    tables.Cover = event.FilePath;
+                    hasCover = true;
                 }
+                break;
             }
         }
-        auto keyCount = osuBeatmap.ManiaKeyCount();
-        if (_Options.KeyMap.size() != keyCount) {
+        if (_Options.KeyMap.size() != chart.KeyCount) {
             throw O2BException(
                 std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
                 + ": Key map size mismatched");
         }
-        for (size_t i = 0; i < osuBeatmap.HitObjects.size(); ++i) {
-            const auto &o = osuBeatmap.HitObjects[i];
-            auto column = o->StartPoint.ManiaColumn(keyCount);
-            BmsReferenceId ref("ZZ");
-            if (_Options.WithKeySounds) {
-                if (const auto &wav = o->StartPoint.CustomHitSound) {
-                    ref = lower_bound(wavs.begin(), wavs.end(), *wav) - wavs.begin() + 1;
+        if (_Options.WithKeySounds) {
+            _DispatchHitNotes<true>(chart, notes, wavId);
+        } else {
+            _DispatchHitNotes<false>(chart, notes, wavId);
+        }
+        tables.Bpms.Finalize();
+        tables.Wavs.Finalize();
+        tables.Bmps.Finalize();
+        tables.AudioWav = shared != nullptr ? audioWav : tables.Wavs.Resolve(audioWav);
+        for (size_t i = 0; i < notes.Size(); ++i) {
+            auto &id = notes.ReferenceIds[i];
+            auto channel = notes.Channels[i];
+            if (id == 0) {
+                continue;
+            } else if (channel == BmsChannelId::Bpm2) {
+                id = static_cast<uint16_t>(tables.Bpms.Resolve(id));
+            } else if (shared != nullptr) {
+                continue;
+            } else if (channel == BmsChannelId::Bga) {
+                id = static_cast<uint16_t>(tables.Bmps.Resolve(id));
+            } else {
+                id = static_cast<uint16_t>(tables.Wavs.Resolve(id));
+            }
+        }
+    }
+
+    // Nearly every chart is 4K or 7K
+    template <bool WithKeySounds, typename WavIdOf>
+    void O2BConverter::_DispatchHitNotes(const O2BChart &chart, _NoteBuffer &notes, WavIdOf &wavIdOf) const {
+        switch (chart.KeyCount) {
+        case 4:
+            _GenerateHitNotes<4, WithKeySounds>(chart, notes, wavIdOf);
+            break;
+        case 7:
+            _GenerateHitNotes<7, WithKeySounds>(chart, notes, wavIdOf);
+            break;
+        default:
+            _GenerateHitNotes<0, WithKeySounds>(chart, notes, wavIdOf);
+            break;
+        }
+    }
+
+    // The specialized kernels copy the channels into a table whose size is
+    // known at compile time, so the loop has no option checks and no lookups
+    // through the options. Columns are within the key count, which
+    // _GenerateNotes has checked against the key map.
+    template <size_t KeyCount, bool WithKeySounds, typename WavIdOf>
+    void O2BConverter::_GenerateHitNotes(const O2BChart &chart, _NoteBuffer &notes, WavIdOf &wavIdOf) const {
+        using namespace std;
+        using namespace Bms;
+        conditional_t<KeyCount == 0, const BmsChannelId *, array<BmsChannelId, 2 * KeyCount>> channels;
+        if constexpr (KeyCount == 0) {
+            channels = _ColumnChannels.data();
+        } else {
+            copy_n(_ColumnChannels.begin(), 2 * KeyCount, channels.begin());
+        }
+        const auto *objects = chart.HitObjects.data();
+        const size_t count = chart.HitObjects.size();
+        for (size_t i = 0; i < count; ++i) {
+            const auto &o = objects[i];
+            // Stays 0 if the object has no key sound, see _AssignReferenceIds
+            size_t ref = 0;
+            if constexpr (WithKeySounds) {
+                if (!o.HitSound.empty()) {
+                    ref = wavIdOf(o.HitSound);
                 }
             }
-            BmsChannelId channel = _Options.KeyMap[column];
-            if (auto ln = dynamic_pointer_cast<OsuHold>(o)) {
-                _Note endNote;
-                channel = static_cast<BmsChannelId>(
-                    static_cast<underlying_type_t<BmsChannelId>>(
-                        _Options.KeyMap[column]) + 40);
-                endNote.Channel = channel;
-                endNote.ReferenceId = ref;
-                endNote.Time = ln->EndTime;
-                endNote.AssociatedObjectType = _Note::HitObject;
-                endNote.AssociatedObjectIndex = i;
-                notes.push_back(endNote);
-            }
-            _Note note;
-            note.Channel = channel;
-            note.ReferenceId = ref;
-            note.Time = o->StartTime;
-            note.AssociatedObjectType = _Note::HitObject;
-            note.AssociatedObjectIndex = i;
-            notes.push_back(note);
-        }
-        sort(notes.begin(), notes.end(), [](const _Note &lhs, const _Note &rhs) {
-            return lhs.Time < rhs.Time;
-        });
-        return notes;
+            const auto channel = channels[2 * o.Column + o.IsHold];
+            if (o.IsHold) {
+                notes.PushBack(o.EndTime, channel, ref, i);
+            }
+            notes.PushBack(o.StartTime, channel, ref, i);
+        }
     }
 
-    void O2BConverter::_ConvertTimeToPosition(
-        const Osu::OsuBeatmap &osuBeatmap,
-        std::vector<_Note> &notes,
-        const std::vector<double> &bpms) {
+    // Stable, so notes sharing a timestamp keep their generation order:
+    // BPM changes first, then BGM, events and hit objects.
+    void O2BConverter::_SortNotes(_Scratch &scratch) const {
+        auto &notes = scratch.Notes;
+        const auto &order = scratch.Order;
+        _Detail::StableRadixOrder(notes.Times, scratch.Order, scratch.OrderScratch);
+        _Detail::ApplyOrder(notes.Times, order, scratch.TimeScratch);
+        _Detail::ApplyOrder(notes.Channels, order, scratch.ChannelScratch);
+        _Detail::ApplyOrder(notes.ReferenceIds, order, scratch.ReferenceIdScratch);
+        _Detail::ApplyOrder(notes.ObjectIndices, order, scratch.OrderScratch);
+    }
+
+    // Only the BPM change notes are visited here. Each one is positioned with
+    // the same expression as the kernel below, so segment starts match exactly.
+    void O2BConverter::_BuildTempoMap(
+        const O2BChart &chart,
+        const _NoteBuffer &notes,
+        const _BpmTable &bpms,
+        _TempoMap &tempoMap) const {
         using namespace std;
         using namespace Bms;
-        if (notes.size() == 0) {
+        tempoMap.Ends.clear();
+        tempoMap.StartTimes.clear();
+        tempoMap.StartPositions.clear();
+        tempoMap.Slopes.clear();
+        if (notes.Size() == 0) {
             return;
         }
         double bpm;
         if (_Options.WithTimingPoints) {
-            const auto &firstTp = osuBeatmap.TimingPoints.front();
-            bpm = firstTp.BeatsPerMinute() / firstTp.Meter;
+            const auto &firstTp = chart.TimingPoints.front();
+            bpm = firstTp.BeatsPerMinute / firstTp.Meter;
         } else {
             bpm = _Options.CustomBpm / _Options.CustomMeter;
         }
         double position = _Options.Offset / _Options.GridSize;
-        auto time = notes.front().Time;
-        for (auto &note : notes) {
-            auto newPosition = position + static_cast<double>(note.Time - time) / 60000.0 * bpm;
-            if (note.Channel == BmsChannelId::Bpm2) {
-                const auto &tp = osuBeatmap.TimingPoints[note.AssociatedObjectIndex];
-                bpm = bpms[note.ReferenceId.UnderlyingValue() - 1] / tp.Meter;
-                position = newPosition;
-                time = note.Time;
+        auto time = notes.Times.front();
+        tempoMap.StartTimes.push_back(time);
+        tempoMap.StartPositions.push_back(position);
+        tempoMap.Slopes.push_back(bpm);
+        for (size_t i = 0; i < notes.Size(); ++i) {
+            if (notes.Channels[i] == BmsChannelId::Bpm2) {
+                position = position + static_cast<double>(notes.Times[i] - time) / 60000.0 * bpm;
+                const auto &tp = chart.TimingPoints[notes.ObjectIndices[i]];
+                bpm = bpms.Value(notes.ReferenceIds[i]) / tp.Meter;
+                time = notes.Times[i];
+                tempoMap.Ends.push_back(i + 1);
+                tempoMap.StartTimes.push_back(time);
+                tempoMap.StartPositions.push_back(position);
+                tempoMap.Slopes.push_back(bpm);
             }
-            note.Position = newPosition;
         }
+        tempoMap.Ends.push_back(notes.Size());
     }
 
-    Bms::BmsBeatmap O2BConverter::_GenerateBmsBeatmap(
-        const Osu::OsuBeatmap &osuBeatmap,
-        const std::vector<_Note> &notes,
-        const std::vector<double> &bpms,
-        const std::vector<std::string> &wavs,
-        const std::vector<std::string> &bmps) {
+    // The inner loop is branch-free over contiguous arrays so it vectorizes
+    void O2BConverter::_ConvertTimeToPosition(
+        _NoteBuffer &notes,
+        const _TempoMap &tempoMap) const {
+        notes.Positions.resize(notes.Size());
+        notes.Slopes.resize(notes.Size());
+        const int32_t *times = notes.Times.data();
+        double *positions = notes.Positions.data();
+        double *slopes = notes.Slopes.data();
+        size_t begin = 0;
+        for (size_t s = 0; s < tempoMap.Ends.size(); ++s) {
+            const size_t end = tempoMap.Ends[s];
+            const int32_t startTime = tempoMap.StartTimes[s];
+            const double startPosition = tempoMap.StartPositions[s];
+            const double slope = tempoMap.Slopes[s];
+            for (size_t i = begin; i < end; ++i) {
+                positions[i] = startPosition + static_cast<double>(times[i] - startTime) / 60000.0 * slope;
+                slopes[i] = slope;
+            }
+            begin = end;
+        }
+    }
+
+    void O2BConverter::_QuantizePositions(_NoteBuffer &notes) const {
+        using namespace std;
+        const size_t n = notes.Size();
+        notes.Sections.resize(n);
+        notes.Indices.resize(n);
+        notes.Fractions.resize(n);
+        const double *positions = notes.Positions.data();
+        uint16_t *sections = notes.Sections.data();
+        uint8_t *indices = notes.Indices.data();
+        double *fractions = notes.Fractions.data();
+        const double gridSize = _Options.GridSize;
+        // Positions are shifted by Offset cells so that truncation rounds;
+        // the exact fractions undo the shift
+        const double shift = _Options.Offset / _Options.GridSize;
+        for (size_t i = 0; i < n; ++i) {
+            const double section = floor(positions[i]);
+            sections[i] = static_cast<uint16_t>(section);
+            indices[i] = static_cast<uint8_t>((positions[i] - section) * gridSize);
+            fractions[i] = positions[i] - section - shift;
+        }
+    }
+
+    void O2BConverter::_AssignReferenceIds(_Scratch &scratch, size_t base, bool withRedefinition) const {
         using namespace std;
         using namespace Bms;
-        BmsBeatmap bmsBeatmap;
-        uint16_t section = 0;
-        map<BmsChannelId, map<uint8_t, BmsReferenceId>> data;
-        multimap<uint8_t, BmsReferenceId> bgmNotes;
-        for (const auto &note : notes) {
-            uint16_t noteSection = (uint16_t)floor(note.Position);
-            if (noteSection != section) {
-                _PushBackSectionData(bmsBeatmap, section, data, bgmNotes);
-                data.clear();
-                bgmNotes.clear();
-                section = noteSection;
+        auto &notes = scratch.Notes;
+        const auto &tables = scratch.Tables;
+        auto &wavIds = scratch.WavIds;
+        const size_t silentId = base * base - 1;
+        const size_t capacity = silentId - 1;
+        auto check = [&](size_t count, const char *what) {
+            if (count > capacity) {
+                throw O2BException(
+                    std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                    + ": " + to_string(count) + " " + what + " need more than the "
+                    + to_string(capacity) + " IDs available in base " + to_string(base));
+            }
+        };
+        check(tables.Bpms.Size(), "BPM values");
+        if (_Options.WithBga) {
+            check(tables.BmpTable().Size(), "BMP files");
+        }
+        const size_t wavCount = tables.WavTable().Size();
+        wavIds.Windowed = false;
+        wavIds.Definitions.clear();
+        wavIds.IdCount = wavCount;
+        wavIds.RedefinitionCount = 0;
+        if (wavCount > capacity) {
+            if (!withRedefinition) {
+                check(wavCount, "WAV files");
+            }
+            _WindowWavIds(notes, wavCount, tables.AudioWav, capacity, wavIds);
+        }
+        for (size_t i = 0; i < notes.Size(); ++i) {
+            auto channel = notes.Channels[i];
+            if (channel == BmsChannelId::Bpm2 || channel == BmsChannelId::Bga) {
+                continue;
+            }
+            auto &id = notes.ReferenceIds[i];
+            if (id == 0) {
+                id = static_cast<uint16_t>(silentId);
+            } else if (wavIds.Windowed) {
+                id = wavIds.Ids[id];
             }
-            uint8_t index = static_cast<uint8_t>((note.Position - noteSection) * _Options.GridSize);
-            if (note.Channel == BmsChannelId::Bgm) {
-                bgmNotes.insert({index, note.ReferenceId});
+        }
+    }
+
+    // Greedy interval partitioning: samples are taken in order of first use
+    // and each gets an ID whose previous sample was last used at least two
+    // sections earlier, so the fewest IDs are used. The spare section lets a
+    // sample keyed near the end of a section ring out before its ID is
+    // redefined. The audio track is still playing long after its only note,
+    // so its ID is never given away.
+    void O2BConverter::_WindowWavIds(
+        const _NoteBuffer &notes, size_t wavCount, size_t audioWav, size_t capacity, _WavAssignment &wavIds) {
+        using namespace std;
+        using namespace Bms;
+        auto &first = wavIds.FirstSections;
+        auto &last = wavIds.LastSections;
+        first.assign(wavCount + 1, numeric_limits<uint16_t>::max());
+        last.assign(wavCount + 1, 0);
+        for (size_t i = 0; i < notes.Size(); ++i) {
+            auto channel = notes.Channels[i];
+            auto id = notes.ReferenceIds[i];
+            if (channel != BmsChannelId::Bpm2 && channel != BmsChannelId::Bga && id != 0) {
+                first[id] = min(first[id], notes.Sections[i]);
+                last[id] = max(last[id], notes.Sections[i]);
+            }
+        }
+        last[audioWav] = numeric_limits<uint16_t>::max();
+        auto &order = wavIds.Order;
+        order.clear();
+        for (uint32_t wav = 1; wav <= wavCount; ++wav) {
+            // Samples only defined by a shared index are left out
+            if (first[wav] != numeric_limits<uint16_t>::max()) {
+                order.push_back(wav);
+            }
+        }
+        stable_sort(order.begin(), order.end(), [&first](uint32_t lhs, uint32_t rhs) {
+            return first[lhs] < first[rhs];
+        });
+        auto &busy = wavIds.Busy;
+        auto &freeIds = wavIds.FreeIds;
+        busy.clear();
+        freeIds.clear();
+        wavIds.Ids.assign(wavCount + 1, 0);
+        const greater<pair<uint16_t, uint16_t>> later;
+        size_t idCount = 0;
+        for (auto wav : order) {
+            while (!busy.empty() && busy.front().first + 1 < first[wav]) {
+                pop_heap(busy.begin(), busy.end(), later);
+                freeIds.push_back(busy.back().second);
+                busy.pop_back();
+            }
+            uint16_t id;
+            bool initial = freeIds.empty();
+            if (initial) {
+                if (idCount == capacity) {
+                    throw O2BException(
+                        std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                        + ": More than " + to_string(capacity)
+                        + " samples overlap in time, even with #WAV redefinition");
+                }
+                id = static_cast<uint16_t>(++idCount);
             } else {
-                data[note.Channel][index] = note.ReferenceId;
+                id = freeIds.back();
+                freeIds.pop_back();
+                ++wavIds.RedefinitionCount;
             }
+            wavIds.Ids[wav] = id;
+            wavIds.Definitions.push_back({ first[wav], id, wav, initial });
+            busy.emplace_back(last[wav], id);
+            push_heap(busy.begin(), busy.end(), later);
         }
-        _PushBackSectionData(bmsBeatmap, section, data, bgmNotes);
-        bmsBeatmap.Artist = osuBeatmap.ArtistUnicode;
-        bmsBeatmap.Bpm = _Options.WithTimingPoints ? osuBeatmap.TimingPoints.front().BeatsPerMinute() : _Options.CustomBpm;
-        bmsBeatmap.Title = osuBeatmap.TitleUnicode;
-        bmsBeatmap.LongNoteType = BmsLongNoteType::NotePair;
-        for (const auto &event : osuBeatmap.Events) {
-            if (auto backgroundEvent = dynamic_pointer_cast<Osu::OsuBackgroundEvent>(event)) {
-                bmsBeatmap.Cover = backgroundEvent->FilePath;
-                break;
+        wavIds.Windowed = true;
+        wavIds.IdCount = idCount;
+    }
+
+    Bms::BmsBeatmap O2BConverter::_GenerateBmsBeatmap(
+        const O2BChart &chart,
+        _Scratch &scratch,
+        _StageProfile &profile,
+        O2BConvertionReport *report) const {
+        using namespace std;
+        using namespace Bms;
+        const auto &notes = scratch.Notes;
+        const auto &tables = scratch.Tables;
+        auto &buffer = scratch.Sections;
+        _StageMeter meter;
+        BmsBeatmap bmsBeatmap;
+        // Bms::BmsBeatmap has no notion of #BASE or of redefinitions
+        _AssignReferenceIds(scratch, 36, false);
+        auto &chunks = scratch.Chunks;
+        if (_SplitSections(notes, chunks)) {
+            _RunChunks(chunks, buffer, [&](_SectionChunk &chunk, _SectionBuffer &buffer) {
+                chunk.MainData.clear();
+                _GenerateSections(notes, chunk.Begin, chunk.End, buffer, [&](uint16_t section, _SectionBuffer &buffer) {
+                    _PushBackSectionData(chunk.MainData, section, buffer);
+                });
+            });
+            for (auto &chunk : chunks) {
+                bmsBeatmap.MainData.insert(bmsBeatmap.MainData.end(), chunk.MainData.begin(), chunk.MainData.end());
+                chunk.MainData.clear();
             }
+        } else {
+            buffer.Clear(_Options.GridSize);
+            _GenerateSections(notes, 0, notes.Size(), buffer, [&](uint16_t section, _SectionBuffer &buffer) {
+                _PushBackSectionData(bmsBeatmap.MainData, section, buffer);
+            });
         }
-        for (size_t i = 0; i < bpms.size(); ++i) {
-            bmsBeatmap.BpmMap[i + 1] = bpms[i];
+        bmsBeatmap.Artist = string(chart.ArtistUnicode);
+        bmsBeatmap.Bpm = _Options.WithTimingPoints ? chart.TimingPoints.front().BeatsPerMinute : _Options.CustomBpm;
+        bmsBeatmap.Title = string(chart.TitleUnicode);
+        bmsBeatmap.LongNoteType = BmsLongNoteType::NotePair;
+        bmsBeatmap.Cover = tables.Cover;
+        for (size_t i = 0; i < tables.Bpms.Size(); ++i) {
+            bmsBeatmap.BpmMap[i + 1] = tables.Bpms.Value(i + 1);
         }
-        for (size_t i = 0; i < wavs.size(); ++i) {
-            bmsBeatmap.WavMap[i + 1] = wavs[i];
+        for (size_t i = 0; i < tables.WavTable().Size(); ++i) {
+            bmsBeatmap.WavMap[i + 1] = tables.WavTable().Value(i + 1);
         }
         if (_Options.WithBga) {
-            for (size_t i = 0; i < bmps.size(); ++i) {
-                bmsBeatmap.BmpMap[i + 1] = bmps[i];
+            for (size_t i = 0; i < tables.BmpTable().Size(); ++i) {
+                bmsBeatmap.BmpMap[i + 1] = tables.BmpTable().Value(i + 1);
             }
         }
+        meter.Record(profile.GenerateBeatmap);
+        _FillReport(notes, tables, scratch.WavIds, buffer, profile, report);
         return bmsBeatmap;
     }
 
-    void O2BConverter::_PushBackSectionData(
-        Bms::BmsBeatmap &bmsBeatmap,
-        const uint16_t &section,
-        const std::map<Bms::BmsChannelId, std::map<uint8_t, Bms::BmsReferenceId>> &data,
-        const std::multimap<uint8_t, Bms::BmsReferenceId> &bgmNotes) {
-        using namespace std;
-        using namespace Bms;
-        auto it = bgmNotes.cbegin();
-        vector<shared_ptr<BmsReferenceListDataUnit>> units;
-        const BmsDataUnitId bgmUnitId(section, BmsChannelId::Bgm);
-        for (uint8_t i = 0; i < _Options.GridSize; ++i) {
-            if (it != bgmNotes.cend() && it->first == i) {
-                if (units.empty()) {
-                    units.push_back(make_shared<BmsReferenceListDataUnit>(bgmUnitId));
-                    units.back()->Value = BmsReferenceListDataUnit::ValueType(_Options.GridSize, 0);
-                }
-                while (it != bgmNotes.cend() && it->first == i) {
-                    bool inserted = false;
-                    for (auto &unit : units) {
-                        if (unit->Value[i].IsPlaceholder()) {
-                            unit->Value[i] = it->second;
-                            inserted = true;
-                            break;
-                        }
-                    }
-                    if (!inserted) {
-                        units.push_back(make_shared<BmsReferenceListDataUnit>(bgmUnitId));
-                        units.back()->Value = BmsReferenceListDataUnit::ValueType(_Options.GridSize, 0);
-                        units.back()->Value[i] = it->second;
-                    }
-                    ++it;
+    void O2BConverter::_WriteHeader(
+        O2BBmsWriter &writer,
+        const O2BChart &chart,
+        const _ResourceTables &tables,
+        const _WavAssignment &wavIds) const {
+        if (_Options.ReferenceBase != 36) {
+            writer.WriteBase(_Options.ReferenceBase);
+        }
+        writer.WriteField("PLAYER", "1");
+        writer.WriteField("TITLE", chart.TitleUnicode);
+        writer.WriteField("ARTIST", chart.ArtistUnicode);
+        writer.WriteField("BPM", _Options.WithTimingPoints ? chart.TimingPoints.front().BeatsPerMinute : _Options.CustomBpm);
+        if (!tables.Cover.empty()) {
+            writer.WriteField("STAGEFILE", tables.Cover);
+        }
+        // Long notes are written as start/end pairs on channels 51-59
+        writer.WriteField("LNTYPE", "1");
+        for (size_t i = 0; i < tables.Bpms.Size(); ++i) {
+            writer.WriteDefinition("BPM", i + 1, tables.Bpms.Value(i + 1));
+        }
+        if (wavIds.Windowed) {
+            for (const auto &definition : wavIds.Definitions) {
+                if (definition.Initial) {
+                    writer.WriteDefinition("WAV", definition.Id, tables.WavTable().Value(definition.Wav));
                 }
             }
+        } else {
+            for (size_t i = 0; i < tables.WavTable().Size(); ++i) {
+                writer.WriteDefinition("WAV", i + 1, tables.WavTable().Value(i + 1));
+            }
         }
-        for (auto &unit : units) {
-            unit->Shrink();
+        if (_Options.WithBga) {
+            for (size_t i = 0; i < tables.BmpTable().Size(); ++i) {
+                writer.WriteDefinition("BMP", i + 1, tables.BmpTable().Value(i + 1));
+            }
         }
-        for (const auto &unit : units) {
-            bmsBeatmap.MainData.push_back(unit);
+    }
+
+    O2BConverter::_GridCells::_GridCells(uint8_t gridSize)
+        : Cells(gridSize, 0), Fractions(gridSize, 0), Slopes(gridSize, 0) {}
+
+    // A later note on the same cell replaces the earlier one
+    void O2BConverter::_GridCells::Set(uint8_t index, uint16_t referenceId, double fraction, double slope) {
+        Occupied.Set(index);
+        Cells[index] = referenceId;
+        Fractions[index] = fraction;
+        Slopes[index] = slope;
+    }
+
+    O2BConverter::_SectionBuffer::_SectionBuffer()
+        : GridSize(0), BgmLaneCount(0), SectionCount(0) {}
+
+    // Grids are only rebuilt when the grid size changes, which a thread
+    // converting with one set of options never does
+    void O2BConverter::_SectionBuffer::Clear(uint8_t gridSize) {
+        Reset();
+        if (gridSize != GridSize) {
+            GridSize = gridSize;
+            SlotOf.clear();
+            Slots.clear();
+            BgmLanes.clear();
+            BgmDepths.assign(gridSize, 0);
         }
-        for (const auto &field : data) {
-            auto &channel = field.first;
-            auto &notes = field.second;
-            auto it = notes.cbegin();
-            auto unit = make_shared<BmsReferenceListDataUnit>(BmsDataUnitId(section, channel));
-            unit->Value = BmsReferenceListDataUnit::ValueType(_Options.GridSize, 0);
-            for (uint8_t i = 0; i < _Options.GridSize; ++i) {
-                if (it != notes.cend() && it->first == i) {
-                    unit->Value[i] = it->second;
-                    ++it;
+        Stats = _QuantizationStats();
+        SectionCount = 0;
+    }
+
+    void O2BConverter::_SectionBuffer::Put(
+        Bms::BmsChannelId channel, uint8_t index, uint16_t referenceId, double fraction, double slope) {
+        auto value = static_cast<size_t>(channel);
+        if (value >= SlotOf.size()) {
+            SlotOf.resize(value + 1, -1);
+        }
+        if (SlotOf[value] < 0) {
+            SlotOf[value] = static_cast<int32_t>(Slots.size());
+            Slots.push_back({ channel, _GridCells(GridSize) });
+        }
+        auto slotIndex = static_cast<uint32_t>(SlotOf[value]);
+        auto &slot = Slots[slotIndex];
+        if (!slot.Grid.Occupied.Any()) {
+            ActiveSlots.push_back(slotIndex);
+        }
+        slot.Grid.Set(index, referenceId, fraction, slope);
+    }
+
+    // Lanes are only allocated when a section stacks deeper than ever before
+    void O2BConverter::_SectionBuffer::PutBgm(uint8_t index, uint16_t referenceId, double fraction, double slope) {
+        size_t lane = BgmDepths[index]++;
+        if (lane == BgmLanes.size()) {
+            BgmLanes.emplace_back(GridSize);
+        }
+        if (lane == BgmLaneCount) {
+            ++BgmLaneCount;
+        }
+        BgmLanes[lane].Set(index, referenceId, fraction, slope);
+    }
+
+    // Cells are only read where Occupied is set, so they need no clearing
+    void O2BConverter::_SectionBuffer::Reset() {
+        for (auto slot : ActiveSlots) {
+            Slots[slot].Grid.Occupied.Clear();
+        }
+        ActiveSlots.clear();
+        if (BgmLaneCount > 0) {
+            // Every stacked index has its first lane occupied
+            BgmLanes[0].Occupied.ForEach([this](size_t i) {
+                BgmDepths[i] = 0;
+            });
+            for (size_t lane = 0; lane < BgmLaneCount; ++lane) {
+                BgmLanes[lane].Occupied.Clear();
+            }
+            BgmLaneCount = 0;
+        }
+    }
+
+    // Picks the smallest grid on which every note lands within GridTolerance
+    // of its exact time and no two notes share a cell. If no grid up to
+    // GridSize qualifies, the notes keep their cells on the full grid.
+    // Every grid is tried because the best one need not divide GridSize;
+    // the note that rejected the previous grid is checked first, so most
+    // grids are rejected after a single note.
+    void O2BConverter::_FitGrid(const _GridCells &cells, _SectionBuffer &buffer) const {
+        using namespace std;
+        auto &indices = buffer.FitIndices;
+        indices.clear();
+        cells.Occupied.ForEach([&indices](size_t i) {
+            indices.push_back(i);
+        });
+        auto errorOf = [&cells](size_t i, double cell, double grid) {
+            return fabs(cells.Fractions[i] - cell / grid) * 60000.0 / cells.Slopes[i];
+        };
+        auto lands = [&](size_t i, long cell, size_t g) {
+            return cell < static_cast<long>(g)
+                && errorOf(i, static_cast<double>(cell), static_cast<double>(g)) <= _Options.GridTolerance;
+        };
+        const size_t maxGrid = _Options.GridSize;
+        size_t grid = 0;
+        size_t culprit = 0;
+        for (size_t g = max<size_t>(1, indices.size()); g <= maxGrid && grid == 0; ++g) {
+            if (!indices.empty() && !lands(indices[culprit], lround(cells.Fractions[indices[culprit]] * g), g)) {
+                continue;
+            }
+            long previous = -1;
+            bool fits = true;
+            for (size_t k = 0; k < indices.size(); ++k) {
+                auto i = indices[k];
+                long cell = lround(cells.Fractions[i] * g);
+                if (cell <= previous || !lands(i, cell, g)) {
+                    culprit = k;
+                    fits = false;
+                    break;
                 }
+                previous = cell;
+            }
+            if (fits) {
+                grid = g;
             }
+        }
+        auto &fitted = buffer.Fitted;
+        auto &stats = buffer.Stats;
+        fitted.Occupied.Clear();
+        fitted.GridSize = grid != 0 ? grid : maxGrid;
+        for (auto i : indices) {
+            auto cell = grid != 0 ? static_cast<size_t>(lround(cells.Fractions[i] * grid)) : i;
+            auto error = errorOf(i, static_cast<double>(cell), static_cast<double>(fitted.GridSize));
+            fitted.Occupied.Set(cell);
+            fitted.Cells[cell] = cells.Cells[i];
+            stats.MaxError = max(stats.MaxError, error);
+            stats.ErrorSum += error;
+            ++stats.ErrorCount;
+            if (error > _Options.GridTolerance) {
+                ++stats.OffGridCount;
+            }
+        }
+    }
+
+    void O2BConverter::_FillReport(
+        const _NoteBuffer &notes,
+        const _ResourceTables &tables,
+        const _WavAssignment &wavIds,
+        const _SectionBuffer &buffer,
+        const _StageProfile &profile,
+        O2BConvertionReport *report) const {
+        if (report == nullptr) {
+            return;
+        }
+        const auto &stats = buffer.Stats;
+        report->NoteCount = notes.Size();
+        report->BpmCount = tables.Bpms.Size();
+        report->RawBpmChangeCount = tables.BpmChanges.Candidates.size();
+        report->BpmChangeCount = tables.BpmChanges.Kept.size();
+        report->RawBpmCount = tables.BpmChanges.RawBpms.Size();
+        report->WavCount = tables.WavTable().Size();
+        report->BmpCount = _Options.WithBga ? tables.BmpTable().Size() : 0;
+        report->SectionCount = buffer.SectionCount;
+        report->WavIdCount = wavIds.IdCount;
+        report->WavRedefinitionCount = wavIds.RedefinitionCount;
+        report->MaxTimingError = stats.MaxError;
+        report->MeanTimingError = stats.ErrorCount > 0 ? stats.ErrorSum / stats.ErrorCount : 0;
+        report->OffGridNoteCount = stats.OffGridCount;
+        report->Stages = profile;
+    }
+
+    void O2BConverter::_PushBackSectionData(
+        _MainData &mainData,
+        const uint16_t &section,
+        _SectionBuffer &buffer) const {
+        using namespace std;
+        using namespace Bms;
+        auto pushBack = [&](BmsChannelId channel, const _GridCells &cells) {
+            _FitGrid(cells, buffer);
+            const auto &fitted = buffer.Fitted;
+            auto unit = make_shared<BmsReferenceListDataUnit>(BmsDataUnitId(section, channel));
+            unit->Value = BmsReferenceListDataUnit::ValueType(fitted.GridSize, 0);
+            fitted.Occupied.ForEach([&](size_t i) {
+                unit->Value[i] = fitted.Cells[i];
+            });
             unit->Shrink();
-            bmsBeatmap.MainData.push_back(unit);
+            mainData.push_back(unit);
+        };
+        for (size_t lane = 0; lane < buffer.BgmLaneCount; ++lane) {
+            pushBack(BmsChannelId::Bgm, buffer.BgmLanes[lane]);
+        }
+        // Channels are emitted in ascending order, as the ordered map used to
+        sort(buffer.ActiveSlots.begin(), buffer.ActiveSlots.end(), [&buffer](uint32_t lhs, uint32_t rhs) {
+            return buffer.Slots[lhs].Channel < buffer.Slots[rhs].Channel;
+        });
+        for (auto slotIndex : buffer.ActiveSlots) {
+            const auto &slot = buffer.Slots[slotIndex];
+            pushBack(slot.Channel, slot.Grid);
+        }
+    }
+
+    void O2BConverter::_WriteSectionData(
+        O2BBmsWriter &writer,
+        const uint16_t &section,
+        _SectionBuffer &buffer) const {
+        using namespace std;
+        using namespace Bms;
+        auto write = [&](BmsChannelId channel, const _GridCells &cells) {
+            _FitGrid(cells, buffer);
+            const auto &fitted = buffer.Fitted;
+            writer.WriteChannel(section, channel, fitted.Occupied, fitted.Cells, fitted.GridSize);
+        };
+        for (size_t lane = 0; lane < buffer.BgmLaneCount; ++lane) {
+            write(BmsChannelId::Bgm, buffer.BgmLanes[lane]);
+        }
+        sort(buffer.ActiveSlots.begin(), buffer.ActiveSlots.end(), [&buffer](uint32_t lhs, uint32_t rhs) {
+            return buffer.Slots[lhs].Channel < buffer.Slots[rhs].Channel;
+        });
+        for (auto slotIndex : buffer.ActiveSlots) {
+            const auto &slot = buffer.Slots[slotIndex];
+            write(slot.Channel, slot.Grid);
         }
     }
 
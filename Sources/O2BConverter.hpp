@@ -2,65 +2,331 @@
 #ifndef OSU_2_BMS_O2B_CONVERTER_HPP_INCLUDED
 #define OSU_2_BMS_O2B_CONVERTER_HPP_INCLUDED
 
-#include <map>
+#include <cstdint>
+#include <exception>
+#include <ostream>
+#include <string>
+#include <string_view>
 #include <typeinfo>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <Osu.hpp>
 #include <Bms.hpp>
 
+#include "O2BBmsWriter.hpp"
+#include "O2BChart.hpp"
 #include "O2BConvertionOptions.hpp"
+#include "O2BConvertionReport.hpp"
 #include "O2BException.hpp"
+#include "O2BResourceIndex.hpp"
+#include "O2BThreadPool.hpp"
+#include "_Detail/GridBitmap.hpp"
+#include "_Detail/InternTable.hpp"
+#include "_Detail/Stopwatch.hpp"
 
 namespace Osu2Bms {
 
+    // Keeps its own copy of the options and never modifies itself, so one
+    // converter may be shared by several threads. Working storage is kept
+    // per thread and reused across conversions, so a thread which converts
+    // repeatedly only allocates when it meets a chart larger than any before.
     class O2BConverter {
     public:
-        O2BConverter(const O2BConvertionOptions &options);
+        // Sections of long charts are built on sectionPool's workers as well
+        // as on the calling thread. The pool must outlive the converter.
+        O2BConverter(const O2BConvertionOptions &options, O2BThreadPool *sectionPool = nullptr);
     public:
-        Bms::BmsBeatmap operator()(const Osu::OsuBeatmap &osuBeatmap) throw(O2BException);
+        Bms::BmsBeatmap operator()(
+            const Osu::OsuBeatmap &osuBeatmap,
+            O2BConvertionReport *report = nullptr) const;
+        // Streams the BMS text to out, writing each section as soon as it is complete
+        void operator()(
+            const Osu::OsuBeatmap &osuBeatmap,
+            std::ostream &out,
+            O2BConvertionReport *report = nullptr) const;
+        // The same, for a chart read by O2BChartParser
+        Bms::BmsBeatmap operator()(
+            const O2BChart &chart,
+            O2BConvertionReport *report = nullptr) const;
+        void operator()(
+            const O2BChart &chart,
+            std::ostream &out,
+            O2BConvertionReport *report = nullptr) const;
+        // The same, defining every file in resources rather than only those
+        // chart uses. resources must have been built with chart added.
+        Bms::BmsBeatmap operator()(
+            const O2BChart &chart,
+            const O2BResourceIndex &resources,
+            O2BConvertionReport *report = nullptr) const;
+        void operator()(
+            const O2BChart &chart,
+            const O2BResourceIndex &resources,
+            std::ostream &out,
+            O2BConvertionReport *report = nullptr) const;
+        const O2BConvertionOptions &Options() const;
     private:
-        const O2BConvertionOptions &_Options;
+        const O2BConvertionOptions _Options;
+        // Channel of a note in column c is at 2c, of a long note at 2c + 1
+        const std::vector<Bms::BmsChannelId> _ColumnChannels;
+        O2BThreadPool *const _SectionPool;
     private:
-        struct _Note {
-            enum AssociateObjectType {
-                TimingPoint,
-                Event,
-                HitObject,
-                CustomBpm
-            };
-            Bms::BmsChannelId Channel;
-            Bms::BmsReferenceId ReferenceId;
-            union {
-                int32_t Time;
-                double Position; // {Section}.{Persontage} [0, 1000)
-            };
-            AssociateObjectType AssociatedObjectType;
-            size_t AssociatedObjectIndex;
+        static std::vector<Bms::BmsChannelId> _MakeColumnChannels(const std::vector<Bms::BmsChannelId> &keyMap);
+        // Notes are kept as parallel arrays so the sort, the position
+        // conversion and the section scan each touch only the fields they need.
+        struct _NoteBuffer {
+            std::vector<int32_t> Times;
+            std::vector<double> Positions; // {Section}.{Persontage} [0, 1000)
+            std::vector<Bms::BmsChannelId> Channels;
+            std::vector<uint16_t> ReferenceIds; // 0 until resolved
+            std::vector<uint32_t> ObjectIndices; // TimingPoints index for Bpm2 notes
+            std::vector<double> Slopes; // Sections per minute at each note
+            std::vector<uint16_t> Sections;
+            std::vector<uint8_t> Indices; // Grid index within the section
+            std::vector<double> Fractions; // Exact offset within the section, [0, 1)
+            void Reserve(size_t n);
+            void Clear();
+            void PushBack(int32_t time, Bms::BmsChannelId channel, size_t referenceId, size_t objectIndex = 0);
+            size_t Size() const;
         };
-        std::vector<double> _GenerateBpms(const Osu::OsuBeatmap &osuBeatmap);
-        std::vector<std::string> _GenerateWavs(const Osu::OsuBeatmap &osuBeatmap);
-        std::vector<std::string> _GenerateBmps(const Osu::OsuBeatmap &osuBeatmap);
-        std::vector<_Note> _GenerateNotes(
-            const Osu::OsuBeatmap &osuBeatmap,
-            const std::vector<double> &bpms,
-            const std::vector<std::string> &wavs,
-            const std::vector<std::string> &bmps);
+        using _BpmTable = _Detail::InternTable<double>;
+        // Hashed as string_view, so views into the chart are looked up without a copy
+        using _PathTable = O2BResourceIndex::PathTable;
+        // A timing point which becomes a Bpm2 note
+        struct _BpmChange {
+            int32_t Time;
+            uint32_t TimingPoint;
+            uint8_t Meter;
+            double Bpm;
+        };
+        // Candidates holds every timing point which would change the BPM,
+        // Kept those left after coalescing; RawBpms counts distinct values
+        // before coalescing, for the report.
+        struct _BpmChanges {
+            std::vector<_BpmChange> Candidates;
+            std::vector<_BpmChange> Kept;
+            _BpmTable RawBpms;
+        };
+        // Wavs and Bmps stay empty when a shared index is used
+        struct _ResourceTables {
+            _BpmTable Bpms;
+            _BpmChanges BpmChanges;
+            _PathTable Wavs;
+            _PathTable Bmps;
+            const O2BResourceIndex *Shared = nullptr;
+            size_t AudioWav = 0; // Final ID of the audio track
+            std::string Cover;
+            void Clear();
+            const _PathTable &WavTable() const;
+            const _PathTable &BmpTable() const;
+        };
+        static void _Lower(const Osu::OsuBeatmap &osuBeatmap, O2BChart &chart);
+        void _GenerateNotes(
+            const O2BChart &chart,
+            const O2BResourceIndex *shared,
+            _NoteBuffer &notes,
+            _ResourceTables &tables) const;
+        void _CoalesceBpmChanges(const O2BChart &chart, _ResourceTables &tables) const;
+        // KeyCount 0 is the generic kernel
+        template <size_t KeyCount, bool WithKeySounds, typename WavIdOf>
+        void _GenerateHitNotes(const O2BChart &chart, _NoteBuffer &notes, WavIdOf &wavIdOf) const;
+        // Picks the kernel for chart.KeyCount
+        template <bool WithKeySounds, typename WavIdOf>
+        void _DispatchHitNotes(const O2BChart &chart, _NoteBuffer &notes, WavIdOf &wavIdOf) const;
+        using _StageProfile = O2BConvertionReport::StageProfile;
+        // Measures wall time and allocations from construction or the previous Record
+        class _StageMeter {
+        public:
+            _StageMeter();
+            void Record(O2BConvertionReport::Stage &stage);
+        private:
+            _Detail::Stopwatch _Stopwatch;
+            size_t _Allocations;
+        };
+        struct _Scratch;
+        void _PrepareNotes(
+            const O2BChart &chart,
+            const O2BResourceIndex *shared,
+            _Scratch &scratch,
+            _StageProfile &profile) const;
+        void _SortNotes(_Scratch &scratch) const;
+        // Piecewise-linear time to position mapping. Segment i covers the
+        // sorted notes before Ends[i]; a BPM change note closes its segment.
+        struct _TempoMap {
+            std::vector<size_t> Ends;
+            std::vector<int32_t> StartTimes;
+            std::vector<double> StartPositions;
+            std::vector<double> Slopes; // Sections per minute
+        };
+        void _BuildTempoMap(
+            const O2BChart &chart,
+            const _NoteBuffer &notes,
+            const _BpmTable &bpms,
+            _TempoMap &tempoMap) const;
         void _ConvertTimeToPosition(
-            const Osu::OsuBeatmap &osuBeatmap,
-            std::vector<_Note> &notes,
-            const std::vector<double> &bpms);
+            _NoteBuffer &notes,
+            const _TempoMap &tempoMap) const;
+        void _QuantizePositions(_NoteBuffer &notes) const;
+        // #WAV IDs as written. With redefinition, samples whose uses do not
+        // overlap share an ID, which is defined again right before the first
+        // section using its next sample.
+        struct _WavAssignment {
+            struct Definition {
+                uint16_t Section; // First section using the sample
+                uint16_t Id;
+                uint32_t Wav; // Table ID
+                bool Initial; // Written in the header
+            };
+            bool Windowed = false;
+            std::vector<uint16_t> Ids; // By table ID, 0 for unused samples; only when Windowed
+            std::vector<Definition> Definitions; // By first section; only when Windowed
+            size_t IdCount = 0;
+            size_t RedefinitionCount = 0;
+            std::vector<uint16_t> FirstSections;
+            std::vector<uint16_t> LastSections;
+            std::vector<uint32_t> Order;
+            std::vector<std::pair<uint16_t, uint16_t>> Busy; // (last section, ID), a min-heap
+            std::vector<uint16_t> FreeIds;
+        };
+        // Notes without a key sound get the last ID of base, which nothing defines
+        void _AssignReferenceIds(_Scratch &scratch, size_t base, bool withRedefinition) const;
+        static void _WindowWavIds(
+            const _NoteBuffer &notes, size_t wavCount, size_t audioWav, size_t capacity, _WavAssignment &wavIds);
         Bms::BmsBeatmap _GenerateBmsBeatmap(
-            const Osu::OsuBeatmap &osuBeatmap,
-            const std::vector<_Note> &notes,
-            const std::vector<double> &bpms,
-            const std::vector<std::string> &wavs,
-            const std::vector<std::string> &bmps);
+            const O2BChart &chart,
+            _Scratch &scratch,
+            _StageProfile &profile,
+            O2BConvertionReport *report) const;
+        // Notes of one channel (or BGM lane) in the section being built,
+        // indexed on the full GridSize grid
+        struct _GridCells {
+            explicit _GridCells(uint8_t gridSize);
+            _Detail::GridBitmap Occupied;
+            std::vector<uint16_t> Cells;
+            std::vector<double> Fractions;
+            std::vector<double> Slopes;
+            void Set(uint8_t index, uint16_t referenceId, double fraction, double slope);
+        };
+        // Cells of one channel mapped onto the smallest grid that fits them
+        struct _FittedGrid {
+            size_t GridSize;
+            _Detail::GridBitmap Occupied;
+            uint16_t Cells[_Detail::GridBitmap::Capacity];
+        };
+        struct _QuantizationStats {
+            double MaxError = 0;
+            double ErrorSum = 0;
+            size_t ErrorCount = 0;
+            size_t OffGridCount = 0;
+        };
+        // Notes of the section being built, reused across sections. Each channel
+        // gets a slot the first time it is seen; slots touched in the current
+        // section are listed in ActiveSlots.
+        // Stacked BGM notes go to lanes: a note takes the first lane that is
+        // free at its index, which is the number of BGM notes already there.
+        struct _ChannelSlot {
+            Bms::BmsChannelId Channel;
+            _GridCells Grid;
+        };
+        struct _SectionBuffer {
+            _SectionBuffer();
+            uint8_t GridSize;
+            std::vector<int32_t> SlotOf; // By underlying channel value, -1 if none
+            std::vector<_ChannelSlot> Slots;
+            std::vector<uint32_t> ActiveSlots;
+            std::vector<_GridCells> BgmLanes;
+            std::vector<uint16_t> BgmDepths; // Lanes in use at each index
+            size_t BgmLaneCount;
+            _FittedGrid Fitted;
+            std::vector<size_t> FitIndices;
+            _QuantizationStats Stats;
+            size_t SectionCount;
+            void Put(Bms::BmsChannelId channel, uint8_t index, uint16_t referenceId, double fraction, double slope);
+            void PutBgm(uint8_t index, uint16_t referenceId, double fraction, double slope);
+            // Prepares the buffer for a new conversion on a grid of gridSize
+            void Clear(uint8_t gridSize);
+            void Reset();
+        };
+        using _MainData = decltype(Bms::BmsBeatmap::MainData);
+        // Notes [Begin, End) of whole sections, built on one thread into Text
+        // or MainData, which are concatenated in order afterwards
+        struct _SectionChunk {
+            size_t Begin;
+            size_t End;
+            size_t FirstDefinition; // First #WAV redefinition after the previous chunk
+            std::string Text;
+            std::string Line;
+            _MainData MainData;
+            _QuantizationStats Stats;
+            size_t SectionCount;
+            std::exception_ptr Error;
+        };
+        // Fewer sections are not worth handing to other threads
+        static const uint16_t _MinParallelSections = 64;
+        static const uint16_t _MinChunkSections = 16;
+        // Everything a conversion works on, reused by every conversion on the same thread
+        struct _Scratch {
+            O2BChart Chart; // Lowered from an Osu::OsuBeatmap
+            _NoteBuffer Notes;
+            _ResourceTables Tables;
+            _TempoMap TempoMap;
+            _SectionBuffer Sections;
+            _WavAssignment WavIds;
+            std::vector<_SectionChunk> Chunks;
+            std::vector<uint32_t> Order;
+            std::vector<uint32_t> OrderScratch;
+            std::vector<int32_t> TimeScratch;
+            std::vector<Bms::BmsChannelId> ChannelScratch;
+            std::vector<uint16_t> ReferenceIdScratch;
+            std::string Line; // For O2BBmsWriter
+        };
+        static _Scratch &_ThreadScratch();
+        Bms::BmsBeatmap _Convert(
+            const O2BChart &chart,
+            const O2BResourceIndex *shared,
+            O2BConvertionReport *report) const;
+        void _Convert(
+            const O2BChart &chart,
+            const O2BResourceIndex *shared,
+            std::ostream &out,
+            O2BConvertionReport *report) const;
+        template <typename Emit>
+        void _GenerateSections(const _NoteBuffer &notes, size_t begin, size_t end, _SectionBuffer &buffer, Emit emit) const;
+        // Returns false if the chart is built on the calling thread alone
+        bool _SplitSections(const _NoteBuffer &notes, std::vector<_SectionChunk> &chunks) const;
+        template <typename Process>
+        void _RunChunks(std::vector<_SectionChunk> &chunks, _SectionBuffer &buffer, Process process) const;
+        void _WriteSections(
+            O2BBmsWriter &writer,
+            const _NoteBuffer &notes,
+            size_t begin,
+            size_t end,
+            const _ResourceTables &tables,
+            const _WavAssignment &wavIds,
+            size_t nextDefinition,
+            _SectionBuffer &buffer) const;
+        void _FitGrid(const _GridCells &cells, _SectionBuffer &buffer) const;
+        void _FillReport(
+            const _NoteBuffer &notes,
+            const _ResourceTables &tables,
+            const _WavAssignment &wavIds,
+            const _SectionBuffer &buffer,
+            const _StageProfile &profile,
+            O2BConvertionReport *report) const;
         void _PushBackSectionData(
-            Bms::BmsBeatmap &bmsBeatmap,
+            _MainData &mainData,
+            const uint16_t &section,
+            _SectionBuffer &buffer) const;
+        void _WriteHeader(
+            O2BBmsWriter &writer,
+            const O2BChart &chart,
+            const _ResourceTables &tables,
+            const _WavAssignment &wavIds) const;
+        void _WriteSectionData(
+            O2BBmsWriter &writer,
             const uint16_t &section,
-            const std::map<Bms::BmsChannelId, std::map<uint8_t, Bms::BmsReferenceId>> &data,
-            const std::multimap<uint8_t, Bms::BmsReferenceId> &bgmNotes);
+            _SectionBuffer &buffer) const;
     };
 
 }
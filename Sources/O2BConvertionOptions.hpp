@@ -16,13 +16,28 @@ namespace Osu2Bms {
         double CustomBpm = 0;
         uint8_t CustomMeter = 4;
         uint8_t GridSize = 192;
+        double GridTolerance = 1; // Milliseconds a note may move to fit a smaller grid
         double Offset = 0;
         bool WithTimingPoints = true;
         bool WithInheritedTimingPoints = true;
+        // BPM changes within this ratio of the current BPM are dropped, and
+        // BPM values are snapped to steps of this ratio. 0 only drops changes
+        // which change nothing. Note times are unaffected; only the scroll
+        // speed between changes is approximated.
+        double BpmTolerance = 0;
+        // Most distinct BPM values to write, 0 for no limit. The tolerance is
+        // widened until the table fits.
+        size_t MaxBpmCount = 0;
         bool WithBmps = true;
         bool WithEventSounds = true;
         bool WithKeySounds = true;
         bool WithBga = true;
+        // 36, or 62 for players which accept #BASE 62. Streamed output only;
+        // a Bms::BmsBeatmap always uses base 36.
+        uint8_t ReferenceBase = 36;
+        // Lets samples whose uses do not overlap share a #WAV ID when there
+        // are more samples than IDs. Streamed output only.
+        bool WithWavRedefinition = false;
         std::vector<Bms::BmsChannelId> KeyMap;
     };
 
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_CONVERTION_REPORT_HPP_INCLUDED
+#define OSU_2_BMS_O2B_CONVERTION_REPORT_HPP_INCLUDED
+
+#include <cstddef>
+
+namespace Osu2Bms {
+
+    // Statistics about a single conversion, filled in by O2BConverter
+    struct O2BConvertionReport {
+        size_t NoteCount = 0;
+        size_t BpmCount = 0;
+        size_t WavCount = 0;
+        size_t BmpCount = 0;
+        size_t SectionCount = 0;
+        // Timing points which would change the BPM, and the Bpm2 notes left
+        // after O2BConvertionOptions::BpmTolerance coalesced them
+        size_t RawBpmChangeCount = 0;
+        size_t BpmChangeCount = 0;
+        // Distinct BPM values before coalescing; BpmCount is after
+        size_t RawBpmCount = 0;
+        // #WAV IDs written, fewer than WavCount when samples share IDs
+        size_t WavIdCount = 0;
+        // #WAV lines in the main data which give an ID a new sample
+        size_t WavRedefinitionCount = 0;
+        // Distance between each note's exact time and its grid cell, in milliseconds
+        double MaxTimingError = 0;
+        double MeanTimingError = 0;
+        // Notes which could not be placed within O2BConvertionOptions::GridTolerance
+        size_t OffGridNoteCount = 0;
+        struct Stage {
+            double Milliseconds = 0; // Wall time
+            size_t Allocations = 0; // Calls to operator new on the converting thread
+        };
+        struct StageProfile {
+            Stage GenerateNotes; // BPM, WAV and BMP tables are built in the same pass
+            Stage SortNotes;
+            Stage ConvertTimeToPosition;
+            Stage QuantizePositions;
+            Stage GenerateBeatmap; // Building the Bms::BmsBeatmap, or writing the BMS text
+        } Stages;
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_CONVERTION_REPORT_HPP_INCLUDED
@@ -0,0 +1,155 @@
+#include "O2BDirectoryWatcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#if defined(__linux__)
+#   include <poll.h>
+#   include <sys/inotify.h>
+#   include <unistd.h>
+#endif
+
+namespace Osu2Bms {
+
+#if defined(__linux__)
+
+    using namespace std::experimental::filesystem;
+
+    namespace {
+
+        const uint32_t directoryMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+    }
+
+    O2BDirectoryWatcher::O2BDirectoryWatcher(const std::string &root)
+        : _Root(root), _Fd(inotify_init1(IN_CLOEXEC)), _Buffer(64 * 1024) {
+        if (_Fd < 0) {
+            throw O2BException(std::string("Could not start watching: ") + std::strerror(errno));
+        }
+        try {
+            _AddWatches(root, nullptr);
+        } catch (...) {
+            close(_Fd);
+            throw;
+        }
+    }
+
+    O2BDirectoryWatcher::~O2BDirectoryWatcher() {
+        close(_Fd);
+    }
+
+    std::vector<std::string> O2BDirectoryWatcher::WaitForChanges(std::chrono::milliseconds debounce) {
+        std::vector<std::string> changed;
+        while (changed.empty()) {
+            _ReadEvents(-1, changed);
+        }
+        while (_ReadEvents(static_cast<int>(debounce.count()), changed)) {}
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        return changed;
+    }
+
+    void O2BDirectoryWatcher::_AddWatches(const std::string &directory, std::vector<std::string> *found) {
+        int wd = inotify_add_watch(_Fd, directory.c_str(), directoryMask);
+        if (wd < 0) {
+            // A directory removed before it could be watched is not an error
+            if (errno == ENOENT || errno == ENOTDIR) {
+                return;
+            }
+            throw O2BException("Could not watch " + directory + ": " + std::strerror(errno));
+        }
+        _Directories[wd] = directory;
+        std::error_code error;
+        for (directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            auto status = it->symlink_status(error);
+            if (error) {
+                error.clear();
+                continue;
+            }
+            if (is_directory(status)) {
+                _AddWatches(it->path().string(), found);
+            } else if (found != nullptr && is_regular_file(status)) {
+                found->push_back(it->path().string());
+            }
+        }
+    }
+
+    bool O2BDirectoryWatcher::_ReadEvents(int timeout, std::vector<std::string> &changed) {
+        pollfd pfd = { _Fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return true;
+            }
+            throw O2BException(std::string("Could not wait for changes: ") + std::strerror(errno));
+        }
+        if (ready == 0) {
+            return false;
+        }
+        auto length = read(_Fd, _Buffer.data(), _Buffer.size());
+        if (length < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                return true;
+            }
+            throw O2BException(std::string("Could not read changes: ") + std::strerror(errno));
+        }
+        for (ssize_t offset = 0; offset < length;) {
+            inotify_event event;
+            std::memcpy(&event, _Buffer.data() + offset, sizeof(event));
+            const char *name = _Buffer.data() + offset + sizeof(event);
+            offset += sizeof(event) + event.len;
+            if (event.mask & IN_Q_OVERFLOW) {
+                // Events were lost, so the only way to catch up is a full scan
+                _Directories.clear();
+                close(_Fd);
+                _Fd = inotify_init1(IN_CLOEXEC);
+                if (_Fd < 0) {
+                    throw O2BException(std::string("Could not restart watching: ") + std::strerror(errno));
+                }
+                _AddWatches(_Root, &changed);
+                return true;
+            }
+            if (event.mask & IN_IGNORED) {
+                _Directories.erase(event.wd);
+                continue;
+            }
+            auto directory = _Directories.find(event.wd);
+            if (directory == _Directories.end() || event.len == 0) {
+                continue;
+            }
+            auto path = directory->second + "/" + name;
+            if (event.mask & IN_ISDIR) {
+                if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                    _AddWatches(path, &changed);
+                }
+            } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                changed.push_back(path);
+            }
+        }
+        return true;
+    }
+
+#else
+
+    O2BDirectoryWatcher::O2BDirectoryWatcher(const std::string &root)
+        : _Root(root), _Fd(-1) {
+        throw O2BException("Watching directories is only supported on Linux");
+    }
+
+    O2BDirectoryWatcher::~O2BDirectoryWatcher() {}
+
+    std::vector<std::string> O2BDirectoryWatcher::WaitForChanges(std::chrono::milliseconds) {
+        return std::vector<std::string>();
+    }
+
+    void O2BDirectoryWatcher::_AddWatches(const std::string &, std::vector<std::string> *) {}
+
+    bool O2BDirectoryWatcher::_ReadEvents(int, std::vector<std::string> &) {
+        return false;
+    }
+
+#endif
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_DIRECTORY_WATCHER_HPP_INCLUDED
+#define OSU_2_BMS_O2B_DIRECTORY_WATCHER_HPP_INCLUDED
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // Reports files written or moved into a directory tree, using inotify.
+    // Every directory is watched once, when the watcher is created or when
+    // the directory appears, so changes never trigger a rescan of the tree.
+    // Only available on Linux; elsewhere the constructor throws.
+    class O2BDirectoryWatcher {
+    public:
+        explicit O2BDirectoryWatcher(const std::string &root);
+        O2BDirectoryWatcher(const O2BDirectoryWatcher &) = delete;
+        O2BDirectoryWatcher &operator=(const O2BDirectoryWatcher &) = delete;
+        ~O2BDirectoryWatcher();
+    public:
+        // Blocks until a file changes, then keeps collecting until no event
+        // has arrived for debounce. Returns each changed path once, sorted.
+        std::vector<std::string> WaitForChanges(std::chrono::milliseconds debounce);
+    private:
+        std::string _Root;
+        int _Fd;
+        std::unordered_map<int, std::string> _Directories; // By watch descriptor
+        std::vector<char> _Buffer;
+    private:
+        // Files already in a directory which appears later are reported through found
+        void _AddWatches(const std::string &directory, std::vector<std::string> *found);
+        // Returns false if nothing arrived within timeout milliseconds, -1 for no limit
+        bool _ReadEvents(int timeout, std::vector<std::string> &changed);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_DIRECTORY_WATCHER_HPP_INCLUDED
@@ -0,0 +1,113 @@
+#include "O2BMappedFile.hpp"
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace Osu2Bms {
+
+#if defined(_WIN32)
+
+    O2BMappedFile::O2BMappedFile(const std::string &path)
+        : _Data(nullptr), _Size(0), _File(INVALID_HANDLE_VALUE), _Mapping(nullptr) {
+        _File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (_File == INVALID_HANDLE_VALUE) {
+            throw O2BException("Could not open file at " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_File, &size)) {
+            CloseHandle(_File);
+            throw O2BException("Could not read file at " + path);
+        }
+        _Size = static_cast<size_t>(size.QuadPart);
+        // Empty files cannot be mapped
+        if (_Size == 0) {
+            return;
+        }
+        _Mapping = CreateFileMappingA(_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_Mapping != nullptr) {
+            _Data = static_cast<const char *>(MapViewOfFile(_Mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (_Data == nullptr) {
+            if (_Mapping != nullptr) {
+                CloseHandle(_Mapping);
+            }
+            CloseHandle(_File);
+            throw O2BException("Could not map file at " + path);
+        }
+    }
+
+    O2BMappedFile::~O2BMappedFile() {
+        if (_Data != nullptr) {
+            UnmapViewOfFile(_Data);
+        }
+        if (_Mapping != nullptr) {
+            CloseHandle(_Mapping);
+        }
+        CloseHandle(_File);
+    }
+
+#else
+
+    O2BMappedFile::O2BMappedFile(const std::string &path)
+        : _Data(nullptr), _Size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw O2BException("Could not open file at " + path);
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            close(fd);
+            throw O2BException("Could not read file at " + path);
+        }
+        _Size = static_cast<size_t>(status.st_size);
+        // Empty files cannot be mapped
+        if (_Size > 0) {
+            void *data = mmap(nullptr, _Size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw O2BException("Could not map file at " + path);
+            }
+            // The file is read front to back exactly once
+            madvise(data, _Size, MADV_SEQUENTIAL);
+            _Data = static_cast<const char *>(data);
+        }
+        // The mapping stays valid after the descriptor is closed
+        close(fd);
+    }
+
+    O2BMappedFile::~O2BMappedFile() {
+        if (_Data != nullptr) {
+            munmap(const_cast<char *>(_Data), _Size);
+        }
+    }
+
+#endif
+
+    std::string_view O2BMappedFile::View() const {
+        return std::string_view(_Data, _Size);
+    }
+
+    void O2BMappedFile::Prefetch() const {
+        const size_t pageSize = 4096;
+#if !defined(_WIN32)
+        if (_Size > 0) {
+            madvise(const_cast<char *>(_Data), _Size, MADV_WILLNEED);
+        }
+#endif
+        // One byte per page faults the whole file in
+        volatile char sink = 0;
+        for (size_t i = 0; i < _Size; i += pageSize) {
+            sink = sink + _Data[i];
+        }
+    }
+
+}
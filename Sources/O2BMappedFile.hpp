@@ -0,0 +1,35 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_MAPPED_FILE_HPP_INCLUDED
+#define OSU_2_BMS_O2B_MAPPED_FILE_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // A read-only memory mapping of a whole file
+    class O2BMappedFile {
+    public:
+        explicit O2BMappedFile(const std::string &path);
+        O2BMappedFile(const O2BMappedFile &) = delete;
+        O2BMappedFile &operator=(const O2BMappedFile &) = delete;
+        ~O2BMappedFile();
+    public:
+        std::string_view View() const;
+        // Reads every page in now, so later reads of View() do not wait on the disk
+        void Prefetch() const;
+    private:
+        const char *_Data;
+        size_t _Size;
+#if defined(_WIN32)
+        void *_File;
+        void *_Mapping;
+#endif
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_MAPPED_FILE_HPP_INCLUDED
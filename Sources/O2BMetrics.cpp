@@ -0,0 +1,202 @@
+#include "O2BMetrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+namespace Osu2Bms {
+
+    const std::vector<double> O2BMetrics::_Bounds = {
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+    O2BMetrics::O2BMetrics()
+        : _Start(std::chrono::steady_clock::now()), _Charts(0), _CachedCharts(0), _InputBytes(0), _OutputBytes(0) {}
+
+    void O2BMetrics::CountChart(size_t inputBytes, size_t outputBytes) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        ++_Charts;
+        _InputBytes += inputBytes;
+        _OutputBytes += outputBytes;
+    }
+
+    void O2BMetrics::CountCachedChart() {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        ++_CachedCharts;
+    }
+
+    void O2BMetrics::CountFailure(const std::string &type) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        ++_Failures[type];
+    }
+
+    void O2BMetrics::ObserveStage(const std::string &stage, double milliseconds) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        _Observe(_Stages, stage, milliseconds);
+    }
+
+    void O2BMetrics::ObserveConverterStages(const O2BConvertionReport::StageProfile &stages) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        _Observe(_ConverterStages, "GenerateNotes", stages.GenerateNotes.Milliseconds);
+        _Observe(_ConverterStages, "SortNotes", stages.SortNotes.Milliseconds);
+        _Observe(_ConverterStages, "ConvertTimeToPosition", stages.ConvertTimeToPosition.Milliseconds);
+        _Observe(_ConverterStages, "QuantizePositions", stages.QuantizePositions.Milliseconds);
+        _Observe(_ConverterStages, "GenerateBeatmap", stages.GenerateBeatmap.Milliseconds);
+    }
+
+    void O2BMetrics::Write(std::ostream &out) const {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        std::chrono::duration<double> uptime = std::chrono::steady_clock::now() - _Start;
+        auto seconds = uptime.count();
+        out << "# HELP osu2bms_uptime_seconds Time since the run started\n"
+            << "# TYPE osu2bms_uptime_seconds gauge\n"
+            << "osu2bms_uptime_seconds " << seconds << "\n"
+            << "# HELP osu2bms_charts_total Charts converted\n"
+            << "# TYPE osu2bms_charts_total counter\n"
+            << "osu2bms_charts_total " << _Charts << "\n"
+            << "# HELP osu2bms_cached_charts_total Charts taken from the cache\n"
+            << "# TYPE osu2bms_cached_charts_total counter\n"
+            << "osu2bms_cached_charts_total " << _CachedCharts << "\n"
+            << "# HELP osu2bms_charts_per_second Charts converted per second since the run started\n"
+            << "# TYPE osu2bms_charts_per_second gauge\n"
+            << "osu2bms_charts_per_second " << (seconds > 0 ? _Charts / seconds : 0) << "\n"
+            << "# HELP osu2bms_input_bytes_total Bytes of .osu text read for converted charts\n"
+            << "# TYPE osu2bms_input_bytes_total counter\n"
+            << "osu2bms_input_bytes_total " << _InputBytes << "\n"
+            << "# HELP osu2bms_output_bytes_total Bytes of BMS text written\n"
+            << "# TYPE osu2bms_output_bytes_total counter\n"
+            << "osu2bms_output_bytes_total " << _OutputBytes << "\n"
+            << "# HELP osu2bms_failures_total Files or charts which failed, by exception type\n"
+            << "# TYPE osu2bms_failures_total counter\n";
+        for (const auto &failure : _Failures) {
+            out << "osu2bms_failures_total{type=\"" << failure.first << "\"} " << failure.second << "\n";
+        }
+        out << "# HELP osu2bms_peak_resident_bytes Peak resident memory of the process\n"
+            << "# TYPE osu2bms_peak_resident_bytes gauge\n"
+            << "osu2bms_peak_resident_bytes " << PeakResidentMemory() << "\n";
+        _WriteHistograms(out, "osu2bms_stage_duration_seconds",
+            "Wall time of a pipeline stage per input file", _Stages);
+        _WriteHistograms(out, "osu2bms_converter_stage_duration_seconds",
+            "Wall time of a converter stage per chart", _ConverterStages);
+    }
+
+    void O2BMetrics::WriteFile(const std::string &path) const {
+        auto temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary);
+            if (!out) {
+                throw O2BException("Could not open file at " + temporary);
+            }
+            Write(out);
+            out.close();
+            if (!out) {
+                throw O2BException("Could not write file at " + temporary);
+            }
+        }
+#if defined(_WIN32)
+        std::remove(path.c_str());
+#endif
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            throw O2BException("Could not write file at " + path);
+        }
+    }
+
+    // ru_maxrss is in kilobytes on Linux and in bytes on macOS
+    uint64_t O2BMetrics::PeakResidentMemory() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#   if defined(__APPLE__)
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#   else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#   endif
+#endif
+    }
+
+    void O2BMetrics::_Observe(_HistogramFamily &family, const std::string &stage, double milliseconds) {
+        auto &histogram = family[stage];
+        if (histogram.Counts.empty()) {
+            histogram.Counts.assign(_Bounds.size(), 0);
+        }
+        auto seconds = milliseconds / 1000;
+        auto first = std::lower_bound(_Bounds.begin(), _Bounds.end(), seconds) - _Bounds.begin();
+        for (auto i = static_cast<size_t>(first); i < _Bounds.size(); ++i) {
+            ++histogram.Counts[i];
+        }
+        ++histogram.Count;
+        histogram.Sum += seconds;
+    }
+
+    void O2BMetrics::_WriteHistograms(
+        std::ostream &out, const char *name, const char *help, const _HistogramFamily &family) {
+        out << "# HELP " << name << ' ' << help << "\n"
+            << "# TYPE " << name << " histogram\n";
+        for (const auto &entry : family) {
+            const auto &stage = entry.first;
+            const auto &histogram = entry.second;
+            for (size_t i = 0; i < _Bounds.size(); ++i) {
+                out << name << "_bucket{stage=\"" << stage << "\",le=\"" << _Bounds[i] << "\"} "
+                    << histogram.Counts[i] << "\n";
+            }
+            out << name << "_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << histogram.Count << "\n"
+                << name << "_sum{stage=\"" << stage << "\"} " << histogram.Sum << "\n"
+                << name << "_count{stage=\"" << stage << "\"} " << histogram.Count << "\n";
+        }
+    }
+
+    O2BMetricsExporter::O2BMetricsExporter(
+        const O2BMetrics &metrics, const std::string &path, std::chrono::milliseconds interval)
+        : _Metrics(metrics), _Path(path), _Interval(interval), _Stopping(false) {
+        _Thread = std::thread([this] {
+            std::unique_lock<std::mutex> lock(_Mutex);
+            while (!_Stopped.wait_for(lock, _Interval, [this] { return _Stopping; })) {
+                lock.unlock();
+                try {
+                    _Metrics.WriteFile(_Path);
+                } catch (const O2BException &) {
+                    // Retried at the next interval, and reported by Finish
+                }
+                lock.lock();
+            }
+        });
+    }
+
+    O2BMetricsExporter::~O2BMetricsExporter() {
+        _Stop();
+    }
+
+    void O2BMetricsExporter::Finish() {
+        _Stop();
+        _Metrics.WriteFile(_Path);
+    }
+
+    void O2BMetricsExporter::_Stop() {
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            _Stopping = true;
+        }
+        _Stopped.notify_one();
+        if (_Thread.joinable()) {
+            _Thread.join();
+        }
+    }
+
+}
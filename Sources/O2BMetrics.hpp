@@ -0,0 +1,90 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_METRICS_HPP_INCLUDED
+#define OSU_2_BMS_O2B_METRICS_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "O2BConvertionReport.hpp"
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // Throughput, latency and failure metrics of a run, written in the
+    // Prometheus text format. Every method may be called from several
+    // threads at once; updates take one lock, which is cheap next to a
+    // conversion.
+    class O2BMetrics {
+    public:
+        O2BMetrics();
+    public:
+        void CountChart(size_t inputBytes, size_t outputBytes);
+        // Charts whose output was taken from the cache
+        void CountCachedChart();
+        // type is the name of the exception which failed the chart
+        void CountFailure(const std::string &type);
+        // Wall time of a pipeline stage working on one input file
+        void ObserveStage(const std::string &stage, double milliseconds);
+        // Wall time of each converter stage, from the report of one chart
+        void ObserveConverterStages(const O2BConvertionReport::StageProfile &stages);
+        void Write(std::ostream &out) const;
+        // Replaces the file at once, so that a scraper never reads half of it
+        void WriteFile(const std::string &path) const;
+        // In bytes, 0 where it cannot be queried
+        static uint64_t PeakResidentMemory();
+    private:
+        // Cumulative bucket counts, as Prometheus expects them
+        struct _Histogram {
+            std::vector<uint64_t> Counts;
+            uint64_t Count = 0;
+            double Sum = 0;
+        };
+        using _HistogramFamily = std::map<std::string, _Histogram>;
+        static const std::vector<double> _Bounds; // Seconds
+        const std::chrono::steady_clock::time_point _Start;
+        mutable std::mutex _Mutex;
+        uint64_t _Charts;
+        uint64_t _CachedCharts;
+        uint64_t _InputBytes;
+        uint64_t _OutputBytes;
+        std::map<std::string, uint64_t> _Failures;
+        _HistogramFamily _Stages;
+        _HistogramFamily _ConverterStages;
+    private:
+        static void _Observe(_HistogramFamily &family, const std::string &stage, double milliseconds);
+        static void _WriteHistograms(std::ostream &out, const char *name, const char *help, const _HistogramFamily &family);
+    };
+
+    // Writes a snapshot of metrics to a file every interval from a thread of its own
+    class O2BMetricsExporter {
+    public:
+        O2BMetricsExporter(const O2BMetrics &metrics, const std::string &path, std::chrono::milliseconds interval);
+        O2BMetricsExporter(const O2BMetricsExporter &) = delete;
+        O2BMetricsExporter &operator=(const O2BMetricsExporter &) = delete;
+        ~O2BMetricsExporter();
+    public:
+        // Stops the thread and writes the final snapshot. Periodic snapshots
+        // which fail are retried at the next interval; this one throws.
+        void Finish();
+    private:
+        const O2BMetrics &_Metrics;
+        const std::string _Path;
+        const std::chrono::milliseconds _Interval;
+        std::mutex _Mutex;
+        std::condition_variable _Stopped;
+        bool _Stopping;
+        std::thread _Thread;
+    private:
+        void _Stop();
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_METRICS_HPP_INCLUDED
@@ -0,0 +1,87 @@
+#include "O2BResourceIndex.hpp"
+
+#include <stdexcept>
+
+#include "_Detail/Hash.hpp"
+#include "_Detail/Utilities.hpp"
+
+namespace Osu2Bms {
+
+    // Mirrors what O2BConverter::_GenerateNotes interns
+    void O2BResourceIndex::Add(const O2BChart &chart, const O2BConvertionOptions &options) {
+        if (_Finalized) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": Resource index is already finalized");
+        }
+        _Wavs.Insert(chart.AudioFilename);
+        for (const auto &event : chart.Events) {
+            if (event.Type == O2BChart::EventType::SoundEffect && options.WithEventSounds) {
+                _Wavs.Insert(event.FilePath);
+            } else if (event.Type == O2BChart::EventType::Video && options.WithBga) {
+                _Bmps.Insert(event.FilePath);
+            }
+        }
+        if (options.WithKeySounds) {
+            for (const auto &object : chart.HitObjects) {
+                if (!object.HitSound.empty()) {
+                    _Wavs.Insert(object.HitSound);
+                }
+            }
+        }
+    }
+
+    void O2BResourceIndex::Finalize() {
+        _Wavs.Finalize();
+        _Bmps.Finalize();
+        _Finalized = true;
+    }
+
+    void O2BResourceIndex::Clear() {
+        _Wavs.Clear();
+        _Bmps.Clear();
+        _Finalized = false;
+    }
+
+    size_t O2BResourceIndex::WavId(std::string_view path) const {
+        try {
+            return _Wavs.IdOf(path);
+        } catch (const std::out_of_range &) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": " + std::string(path) + " is not in the resource index");
+        }
+    }
+
+    size_t O2BResourceIndex::BmpId(std::string_view path) const {
+        try {
+            return _Bmps.IdOf(path);
+        } catch (const std::out_of_range &) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": " + std::string(path) + " is not in the resource index");
+        }
+    }
+
+    const O2BResourceIndex::PathTable &O2BResourceIndex::Wavs() const {
+        return _Wavs;
+    }
+
+    const O2BResourceIndex::PathTable &O2BResourceIndex::Bmps() const {
+        return _Bmps;
+    }
+
+    // The lengths are hashed along with the paths, so that moving a file from
+    // one table to the other or splitting a path in two is noticed
+    uint64_t O2BResourceIndex::Fingerprint() const {
+        uint64_t hash = _Detail::Mix64(_Wavs.Size() * 31 + _Bmps.Size());
+        for (const auto *table : { &_Wavs, &_Bmps }) {
+            for (size_t id = 1; id <= table->Size(); ++id) {
+                const auto &path = table->Value(id);
+                hash = _Detail::Hash64(path.data(), path.size(), hash ^ path.size());
+            }
+        }
+        return hash;
+    }
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_RESOURCE_INDEX_HPP_INCLUDED
+#define OSU_2_BMS_O2B_RESOURCE_INDEX_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "O2BChart.hpp"
+#include "O2BConvertionOptions.hpp"
+#include "O2BException.hpp"
+#include "_Detail/InternTable.hpp"
+
+namespace Osu2Bms {
+
+    // #WAV and #BMP definitions shared by every difficulty of a beatmap set,
+    // so that a sample has the same ID in each of them and a player loads it
+    // once per set. Every chart is added before Finalize, after which IDs
+    // follow the sorted paths, as they do for a chart converted on its own.
+    class O2BResourceIndex {
+    public:
+        using PathTable = _Detail::InternTable<std::string, std::hash<std::string_view>>;
+    public:
+        // Adds the files options would make the converter define for chart
+        void Add(const O2BChart &chart, const O2BConvertionOptions &options);
+        void Finalize();
+        void Clear();
+        size_t WavId(std::string_view path) const;
+        size_t BmpId(std::string_view path) const;
+        const PathTable &Wavs() const;
+        const PathTable &Bmps() const;
+        // Changes whenever any definition does
+        uint64_t Fingerprint() const;
+    private:
+        PathTable _Wavs;
+        PathTable _Bmps;
+        bool _Finalized = false;
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_RESOURCE_INDEX_HPP_INCLUDED
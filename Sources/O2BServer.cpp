@@ -0,0 +1,165 @@
+#include "O2BServer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+
+#if !defined(_WIN32)
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/time.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+namespace Osu2Bms {
+
+#if !defined(_WIN32)
+
+    namespace {
+
+        // Replaces a socket file left behind by a server which did not exit
+        // cleanly. Anything else at path, including the socket of a server
+        // which is still running, is left alone.
+        void RemoveStaleSocket(const std::string &path, const sockaddr_un &address) {
+            struct stat status;
+            if (lstat(path.c_str(), &status) != 0) {
+                if (errno == ENOENT) {
+                    return;
+                }
+                throw O2BException("Could not inspect " + path + ": " + std::strerror(errno));
+            }
+            if (!S_ISSOCK(status.st_mode)) {
+                throw O2BException(path + " exists and is not a socket");
+            }
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (probe < 0) {
+                throw O2BException(std::string("Could not create socket: ") + std::strerror(errno));
+            }
+            int result = connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+            int error = errno;
+            close(probe);
+            if (result == 0) {
+                throw O2BException("A server is already listening on " + path);
+            }
+            if (error != ECONNREFUSED) {
+                throw O2BException("Could not connect to " + path + ": " + std::strerror(error));
+            }
+            if (unlink(path.c_str()) != 0) {
+                throw O2BException("Could not remove " + path + ": " + std::strerror(errno));
+            }
+        }
+
+    }
+
+    O2BServer::O2BServer(const std::string &path, size_t workerCount, size_t queueCapacity, Handler handler)
+        : _Path(path), _Fd(-1), _Handler(std::move(handler)), _Connections(queueCapacity) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw O2BException("Socket path is too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        _Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (_Fd < 0) {
+            throw O2BException(std::string("Could not create socket: ") + std::strerror(errno));
+        }
+        try {
+            RemoveStaleSocket(path, address);
+        } catch (const O2BException &) {
+            close(_Fd);
+            throw;
+        }
+        // Only the user running the server may connect to it
+        auto mask = umask(0177);
+        int bound = bind(_Fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+        int error = errno;
+        umask(mask);
+        if (bound != 0 || listen(_Fd, static_cast<int>(queueCapacity)) != 0) {
+            auto description = std::strerror(bound != 0 ? error : errno);
+            close(_Fd);
+            if (bound == 0) {
+                unlink(path.c_str());
+            }
+            throw O2BException("Could not listen on " + path + ": " + description);
+        }
+        if (workerCount == 0) {
+            workerCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < workerCount; ++i) {
+            _Workers.emplace_back(&O2BServer::_Serve, this);
+        }
+    }
+
+    O2BServer::~O2BServer() {
+        _Connections.Close();
+        for (auto &worker : _Workers) {
+            worker.join();
+        }
+        close(_Fd);
+        unlink(_Path.c_str());
+    }
+
+    void O2BServer::Run() {
+        for (;;) {
+            int fd = accept4(_Fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                // The client gave up before it was accepted
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                throw O2BException(std::string("Could not accept connection: ") + std::strerror(errno));
+            }
+            // A client which stops sending releases its worker
+            timeval timeout = {};
+            timeout.tv_sec = static_cast<time_t>(_IdleTimeout.count());
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            // Blocks while every worker is busy and the queue is full
+            if (!_Connections.Push(fd)) {
+                close(fd);
+                return;
+            }
+        }
+    }
+
+#else
+
+    O2BServer::O2BServer(const std::string &path, size_t workerCount, size_t queueCapacity, Handler handler)
+        : _Path(path), _Fd(-1), _Handler(std::move(handler)), _Connections(queueCapacity) {
+        throw O2BException("Unix domain sockets are not supported on this platform");
+    }
+
+    O2BServer::~O2BServer() {}
+
+    void O2BServer::Run() {}
+
+#endif
+
+    size_t O2BServer::WorkerCount() const {
+        return _Workers.size();
+    }
+
+    void O2BServer::_Serve() {
+        int fd;
+        std::vector<std::string> request;
+        std::vector<std::string> response;
+        std::vector<std::string_view> fields;
+        while (_Connections.Pop(fd)) {
+            O2BSocket connection(fd);
+            try {
+                while (connection.Receive(request)) {
+                    response.clear();
+                    _Handler(request, response);
+                    fields.assign(response.begin(), response.end());
+                    connection.Send(fields);
+                }
+            } catch (const O2BException &) {
+                // A broken, malformed or idle connection only affects its own client
+            } catch (const std::exception &) {
+                // Neither does a handler which breaks its promise not to throw
+            }
+        }
+    }
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_SERVER_HPP_INCLUDED
+#define OSU_2_BMS_O2B_SERVER_HPP_INCLUDED
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "O2BException.hpp"
+#include "O2BSocket.hpp"
+#include "_Detail/BoundedQueue.hpp"
+
+namespace Osu2Bms {
+
+    // Serves O2BSocket messages on a Unix domain socket.
+    // Accepted connections wait in a queue of limited capacity for one of a
+    // fixed number of workers. When the queue is full no more connections are
+    // accepted, so further clients wait in the listen backlog and then in
+    // connect until a worker catches up.
+    // A connection may carry any number of requests, answered in order, and
+    // is closed once its client sends nothing for _IdleTimeout.
+    // The socket is only accessible to the user running the server.
+    // Only available on POSIX systems; elsewhere the constructor throws.
+    class O2BServer {
+    public:
+        // Turns a request into a response. Must not throw.
+        using Handler = std::function<void(const std::vector<std::string> &request, std::vector<std::string> &response)>;
+    public:
+        // workerCount 0 means the number of cores
+        O2BServer(const std::string &path, size_t workerCount, size_t queueCapacity, Handler handler);
+        O2BServer(const O2BServer &) = delete;
+        O2BServer &operator=(const O2BServer &) = delete;
+        ~O2BServer();
+    public:
+        // Accepts connections until an unrecoverable error occurs
+        void Run();
+        size_t WorkerCount() const;
+    private:
+        static constexpr std::chrono::seconds _IdleTimeout{ 30 };
+        std::string _Path;
+        int _Fd;
+        Handler _Handler;
+        _Detail::BoundedQueue<int> _Connections;
+        std::vector<std::thread> _Workers;
+    private:
+        void _Serve();
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_SERVER_HPP_INCLUDED
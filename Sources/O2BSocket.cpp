@@ -0,0 +1,172 @@
+#include "O2BSocket.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(_WIN32)
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+namespace Osu2Bms {
+
+    namespace {
+
+        // Larger messages are rejected before anything is allocated for them
+        const uint32_t maxFieldSize = 256u << 20;
+        const uint32_t maxFieldCount = 4096;
+
+        void AppendUInt32(std::string &buffer, uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                buffer += static_cast<char>((value >> (i * 8)) & 0xFF);
+            }
+        }
+
+        uint32_t ReadUInt32(const char *data) {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; ++i) {
+                value |= static_cast<uint32_t>(static_cast<unsigned char>(data[i])) << (i * 8);
+            }
+            return value;
+        }
+
+    }
+
+    O2BSocket::O2BSocket(int fd)
+        : _Fd(fd) {}
+
+    O2BSocket::O2BSocket(O2BSocket &&other)
+        : _Fd(other._Fd), _Buffer(std::move(other._Buffer)) {
+        other._Fd = -1;
+    }
+
+#if !defined(_WIN32)
+
+    O2BSocket::~O2BSocket() {
+        if (_Fd >= 0) {
+            close(_Fd);
+        }
+    }
+
+    O2BSocket O2BSocket::Connect(const std::string &path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw O2BException("Socket path is too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw O2BException(std::string("Could not create socket: ") + std::strerror(errno));
+        }
+        O2BSocket result(fd);
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+            throw O2BException("Could not connect to " + path + ": " + std::strerror(errno));
+        }
+        return result;
+    }
+
+    void O2BSocket::_Write(const char *data, size_t size) {
+        while (size > 0) {
+            auto written = send(_Fd, data, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw O2BException(std::string("Could not send message: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    // Returns false on end of stream before the first byte
+    bool O2BSocket::_Read(char *data, size_t size) {
+        size_t total = 0;
+        while (total < size) {
+            auto received = recv(_Fd, data + total, size - total, 0);
+            if (received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw O2BException(std::string("Could not receive message: ") + std::strerror(errno));
+            }
+            if (received == 0) {
+                if (total == 0) {
+                    return false;
+                }
+                throw O2BException("Connection closed in the middle of a message");
+            }
+            total += static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+#else
+
+    O2BSocket::~O2BSocket() {}
+
+    O2BSocket O2BSocket::Connect(const std::string &path) {
+        throw O2BException("Unix domain sockets are not supported on this platform");
+    }
+
+    void O2BSocket::_Write(const char *data, size_t size) {
+        throw O2BException("Unix domain sockets are not supported on this platform");
+    }
+
+    bool O2BSocket::_Read(char *data, size_t size) {
+        throw O2BException("Unix domain sockets are not supported on this platform");
+    }
+
+#endif
+
+    // Headers are gathered into one buffer so that small messages go out in a
+    // single call; large fields are sent straight from the caller's memory
+    void O2BSocket::Send(const std::vector<std::string_view> &fields) {
+        _Buffer.clear();
+        AppendUInt32(_Buffer, static_cast<uint32_t>(fields.size()));
+        for (const auto &field : fields) {
+            if (field.size() > maxFieldSize) {
+                throw O2BException("Message field is too large to send");
+            }
+            AppendUInt32(_Buffer, static_cast<uint32_t>(field.size()));
+            if (field.size() > 4096) {
+                _Write(_Buffer.data(), _Buffer.size());
+                _Buffer.clear();
+                _Write(field.data(), field.size());
+            } else {
+                _Buffer.append(field.data(), field.size());
+            }
+        }
+        _Write(_Buffer.data(), _Buffer.size());
+    }
+
+    bool O2BSocket::Receive(std::vector<std::string> &fields) {
+        char header[4];
+        if (!_Read(header, sizeof(header))) {
+            return false;
+        }
+        auto count = ReadUInt32(header);
+        if (count > maxFieldCount) {
+            throw O2BException("Message has too many fields");
+        }
+        fields.resize(count);
+        for (auto &field : fields) {
+            if (!_Read(header, sizeof(header))) {
+                throw O2BException("Connection closed in the middle of a message");
+            }
+            auto size = ReadUInt32(header);
+            if (size > maxFieldSize) {
+                throw O2BException("Message field is too large to receive");
+            }
+            field.resize(size);
+            if (size > 0 && !_Read(&field[0], size)) {
+                throw O2BException("Connection closed in the middle of a message");
+            }
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_SOCKET_HPP_INCLUDED
+#define OSU_2_BMS_O2B_SOCKET_HPP_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // A connected Unix domain stream socket exchanging messages.
+    // A message is a list of fields, each sent as a 32-bit little-endian
+    // length followed by its bytes, after a 32-bit field count.
+    // Only available on POSIX systems; elsewhere Connect throws.
+    class O2BSocket {
+    public:
+        // Takes ownership of an already connected descriptor
+        explicit O2BSocket(int fd);
+        O2BSocket(O2BSocket &&other);
+        O2BSocket(const O2BSocket &) = delete;
+        O2BSocket &operator=(const O2BSocket &) = delete;
+        ~O2BSocket();
+    public:
+        static O2BSocket Connect(const std::string &path);
+        void Send(const std::vector<std::string_view> &fields);
+        // Returns false if the peer closed the connection between messages
+        bool Receive(std::vector<std::string> &fields);
+    private:
+        int _Fd;
+        std::string _Buffer;
+    private:
+        void _Write(const char *data, size_t size);
+        bool _Read(char *data, size_t size);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_SOCKET_HPP_INCLUDED
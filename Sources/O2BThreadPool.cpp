@@ -0,0 +1,110 @@
+#include "O2BThreadPool.hpp"
+
+#include <algorithm>
+
+namespace Osu2Bms {
+
+    namespace {
+        // The pool and queue index owned by the current worker thread.
+        // currentPool is null on threads which are not pool workers.
+        thread_local const O2BThreadPool *currentPool = nullptr;
+        thread_local size_t currentIndex = 0;
+    }
+
+    O2BThreadPool::O2BThreadPool(size_t threadCount)
+        : _Queued(0), _Unfinished(0), _NextQueue(0), _Stopping(false) {
+        if (threadCount == 0) {
+            threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            _Queues.push_back(std::make_unique<_Queue>());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            _Threads.emplace_back(&O2BThreadPool::_Run, this, i);
+        }
+    }
+
+    O2BThreadPool::~O2BThreadPool() {
+        Wait();
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            _Stopping = true;
+        }
+        _TaskAvailable.notify_all();
+        for (auto &thread : _Threads) {
+            thread.join();
+        }
+    }
+
+    void O2BThreadPool::Submit(Task task) {
+        size_t index = currentPool == this
+            ? currentIndex
+            : _NextQueue++ % _Queues.size();
+        ++_Unfinished;
+        {
+            auto &queue = *_Queues[index];
+            std::lock_guard<std::mutex> lock(queue.Mutex);
+            queue.Tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            ++_Queued;
+        }
+        _TaskAvailable.notify_one();
+    }
+
+    void O2BThreadPool::Wait() {
+        std::unique_lock<std::mutex> lock(_Mutex);
+        _AllDone.wait(lock, [this] { return _Unfinished == 0; });
+    }
+
+    size_t O2BThreadPool::ThreadCount() const {
+        return _Threads.size();
+    }
+
+    void O2BThreadPool::_Run(size_t index) {
+        currentPool = this;
+        currentIndex = index;
+        Task task;
+        for (;;) {
+            if (_TryPop(index, task)) {
+                --_Queued;
+                task();
+                task = nullptr;
+                if (--_Unfinished == 0) {
+                    std::lock_guard<std::mutex> lock(_Mutex);
+                    _AllDone.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_Mutex);
+            _TaskAvailable.wait(lock, [this] { return _Queued > 0 || _Stopping; });
+            if (_Stopping && _Queued <= 0) {
+                return;
+            }
+        }
+    }
+
+    bool O2BThreadPool::_TryPop(size_t index, Task &task) {
+        {
+            auto &own = *_Queues[index];
+            std::lock_guard<std::mutex> lock(own.Mutex);
+            if (!own.Tasks.empty()) {
+                task = std::move(own.Tasks.back());
+                own.Tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < _Queues.size(); ++i) {
+            auto &victim = *_Queues[(index + i) % _Queues.size()];
+            std::lock_guard<std::mutex> lock(victim.Mutex);
+            if (!victim.Tasks.empty()) {
+                task = std::move(victim.Tasks.front());
+                victim.Tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+}
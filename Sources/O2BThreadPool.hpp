@@ -0,0 +1,54 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_THREAD_POOL_HPP_INCLUDED
+#define OSU_2_BMS_O2B_THREAD_POOL_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Osu2Bms {
+
+    // A fixed-size work-stealing thread pool.
+    // Every worker owns a task deque. Workers pop their own tasks LIFO and
+    // steal from the front of other workers' deques when they run dry.
+    // Tasks must not throw.
+    class O2BThreadPool {
+    public:
+        using Task = std::function<void()>;
+    public:
+        explicit O2BThreadPool(size_t threadCount = 0);
+        O2BThreadPool(const O2BThreadPool &) = delete;
+        O2BThreadPool &operator=(const O2BThreadPool &) = delete;
+        ~O2BThreadPool();
+    public:
+        void Submit(Task task);
+        void Wait();
+        size_t ThreadCount() const;
+    private:
+        struct _Queue {
+            std::mutex Mutex;
+            std::deque<Task> Tasks;
+        };
+        std::vector<std::unique_ptr<_Queue>> _Queues;
+        std::vector<std::thread> _Threads;
+        std::mutex _Mutex;
+        std::condition_variable _TaskAvailable;
+        std::condition_variable _AllDone;
+        std::atomic<std::ptrdiff_t> _Queued;
+        std::atomic<size_t> _Unfinished;
+        std::atomic<size_t> _NextQueue;
+        bool _Stopping;
+    private:
+        void _Run(size_t index);
+        bool _TryPop(size_t index, Task &task);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_THREAD_POOL_HPP_INCLUDED
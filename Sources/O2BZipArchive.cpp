@@ -0,0 +1,161 @@
+#include "O2BZipArchive.hpp"
+
+#include <algorithm>
+
+#include "_Detail/Inflate.hpp"
+
+namespace Osu2Bms {
+
+    namespace {
+
+        const uint32_t localHeaderSignature = 0x04034b50;
+        const uint32_t centralHeaderSignature = 0x02014b50;
+        const uint32_t endOfCentralDirectorySignature = 0x06054b50;
+
+        uint16_t ReadU16(const char *p) {
+            auto u = reinterpret_cast<const uint8_t *>(p);
+            return static_cast<uint16_t>(u[0] | u[1] << 8);
+        }
+
+        uint32_t ReadU32(const char *p) {
+            auto u = reinterpret_cast<const uint8_t *>(p);
+            return static_cast<uint32_t>(u[0]) | static_cast<uint32_t>(u[1]) << 8
+                | static_cast<uint32_t>(u[2]) << 16 | static_cast<uint32_t>(u[3]) << 24;
+        }
+
+    }
+
+    O2BZipArchive::O2BZipArchive(const std::string &path)
+        : _Path(path), _File(path, std::ios::binary), _Size(0) {
+        if (!_File) {
+            throw O2BException("Could not open file at " + path);
+        }
+        _ReadCentralDirectory();
+    }
+
+    const std::vector<O2BZipArchive::Entry> &O2BZipArchive::Entries() const {
+        return _Entries;
+    }
+
+    std::string O2BZipArchive::Read(const Entry &entry) {
+        auto raw = ReadRaw(entry);
+        if (entry.Method == 0) {
+            _Verify(entry, raw);
+            return raw;
+        }
+        auto data = _Inflate(entry, raw);
+        _Verify(entry, data);
+        return data;
+    }
+
+    std::string O2BZipArchive::ReadRaw(const Entry &entry) {
+        auto offset = _DataOffset(entry);
+        // Checked before allocating, since the size comes from the archive
+        if (offset + entry.CompressedSize > _Size) {
+            throw O2BException(_Path + ": Corrupted sizes of " + entry.Name);
+        }
+        std::string raw(entry.CompressedSize, '\0');
+        _File.seekg(offset);
+        if (!_File.read(&raw[0], raw.size())) {
+            throw O2BException(_Path + ": Unexpected end of archive in " + entry.Name);
+        }
+        return raw;
+    }
+
+    std::string O2BZipArchive::ReadVerifiedRaw(const Entry &entry) {
+        auto raw = ReadRaw(entry);
+        if (entry.Method == 0) {
+            _Verify(entry, raw);
+        } else {
+            _Verify(entry, _Inflate(entry, raw));
+        }
+        return raw;
+    }
+
+    void O2BZipArchive::_ReadCentralDirectory() {
+        // The end of central directory record sits in the last 64 KiB + 22 bytes
+        _File.seekg(0, std::ios::end);
+        auto fileSize = _Size = static_cast<uint64_t>(_File.tellg());
+        auto tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize, 0xFFFF + 22));
+        std::string tail(tailSize, '\0');
+        _File.seekg(fileSize - tailSize);
+        if (!_File.read(&tail[0], tailSize)) {
+            throw O2BException(_Path + ": Not a zip archive");
+        }
+        size_t eocd = std::string::npos;
+        for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+            if (ReadU32(&tail[i]) == endOfCentralDirectorySignature) {
+                eocd = i;
+                break;
+            }
+        }
+        if (eocd == std::string::npos) {
+            throw O2BException(_Path + ": Not a zip archive");
+        }
+        auto eocdOffset = fileSize - tailSize + eocd;
+        auto entryCount = ReadU16(&tail[eocd + 10]);
+        auto directorySize = ReadU32(&tail[eocd + 12]);
+        auto directoryOffset = ReadU32(&tail[eocd + 16]);
+        if (directoryOffset == 0xFFFFFFFF || entryCount == 0xFFFF) {
+            throw O2BException(_Path + ": ZIP64 archives are not supported");
+        }
+        // The directory ends where the end of central directory record starts
+        if (static_cast<uint64_t>(directoryOffset) + directorySize > eocdOffset) {
+            throw O2BException(_Path + ": Corrupted central directory");
+        }
+        std::string directory(directorySize, '\0');
+        _File.seekg(directoryOffset);
+        if (!_File.read(&directory[0], directorySize)) {
+            throw O2BException(_Path + ": Corrupted central directory");
+        }
+        _Entries.reserve(entryCount);
+        size_t p = 0;
+        for (uint16_t i = 0; i < entryCount; ++i) {
+            if (p + 46 > directory.size() || ReadU32(&directory[p]) != centralHeaderSignature) {
+                throw O2BException(_Path + ": Corrupted central directory");
+            }
+            Entry entry;
+            entry.Method = ReadU16(&directory[p + 10]);
+            entry.Crc32 = ReadU32(&directory[p + 16]);
+            entry.CompressedSize = ReadU32(&directory[p + 20]);
+            entry.UncompressedSize = ReadU32(&directory[p + 24]);
+            auto nameLength = ReadU16(&directory[p + 28]);
+            auto extraLength = ReadU16(&directory[p + 30]);
+            auto commentLength = ReadU16(&directory[p + 32]);
+            entry.LocalHeaderOffset = ReadU32(&directory[p + 42]);
+            if (p + 46 + nameLength > directory.size()) {
+                throw O2BException(_Path + ": Corrupted central directory");
+            }
+            entry.Name = directory.substr(p + 46, nameLength);
+            p += 46 + nameLength + extraLength + commentLength;
+            if (!entry.Name.empty() && entry.Name.back() != '/') {
+                _Entries.push_back(std::move(entry));
+            }
+        }
+    }
+
+    uint64_t O2BZipArchive::_DataOffset(const Entry &entry) {
+        char header[30];
+        _File.clear();
+        _File.seekg(entry.LocalHeaderOffset);
+        if (!_File.read(header, sizeof(header)) || ReadU32(header) != localHeaderSignature) {
+            throw O2BException(_Path + ": Corrupted local header of " + entry.Name);
+        }
+        return static_cast<uint64_t>(entry.LocalHeaderOffset) + 30 + ReadU16(header + 26) + ReadU16(header + 28);
+    }
+
+    std::string O2BZipArchive::_Inflate(const Entry &entry, const std::string &raw) const {
+        if (entry.Method != 8) {
+            throw O2BException(_Path + ": Unsupported compression method in " + entry.Name);
+        }
+        return _Detail::Inflate(raw.data(), raw.size(), entry.UncompressedSize);
+    }
+
+    void O2BZipArchive::_Verify(const Entry &entry, const std::string &data) const {
+        if (data.size() != entry.UncompressedSize
+            || _Detail::Crc32(data.data(), data.size()) != entry.Crc32) {
+            throw O2BException(_Path + ": Checksum mismatched in " + entry.Name);
+        }
+    }
+
+}
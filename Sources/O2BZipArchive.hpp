@@ -0,0 +1,50 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_ZIP_ARCHIVE_HPP_INCLUDED
+#define OSU_2_BMS_O2B_ZIP_ARCHIVE_HPP_INCLUDED
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "O2BException.hpp"
+
+namespace Osu2Bms {
+
+    // Read-only access to a zip archive such as an .osz beatmap set.
+    // Only the central directory is loaded on construction; entry bodies are
+    // read and inflated on demand, so entries which are never read cost nothing.
+    class O2BZipArchive {
+    public:
+        struct Entry {
+            std::string Name;
+            uint16_t Method;
+            uint32_t Crc32;
+            uint32_t CompressedSize;
+            uint32_t UncompressedSize;
+            uint32_t LocalHeaderOffset;
+        };
+    public:
+        explicit O2BZipArchive(const std::string &path);
+    public:
+        const std::vector<Entry> &Entries() const;
+        std::string Read(const Entry &entry);
+        std::string ReadRaw(const Entry &entry);
+        // The stored bytes, once they are checked to decode to the entry's
+        // size and CRC-32, so that they can be copied without deflating again
+        std::string ReadVerifiedRaw(const Entry &entry);
+    private:
+        std::string _Path;
+        std::ifstream _File;
+        uint64_t _Size;
+        std::vector<Entry> _Entries;
+    private:
+        void _ReadCentralDirectory();
+        uint64_t _DataOffset(const Entry &entry);
+        std::string _Inflate(const Entry &entry, const std::string &raw) const;
+        void _Verify(const Entry &entry, const std::string &data) const;
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_ZIP_ARCHIVE_HPP_INCLUDED
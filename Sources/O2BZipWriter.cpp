@@ -0,0 +1,198 @@
+#include "O2BZipWriter.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+
+#include "O2BMappedFile.hpp"
+#include "_Detail/Deflate.hpp"
+#include "_Detail/Inflate.hpp"
+#include "_Detail/Utilities.hpp"
+
+namespace Osu2Bms {
+
+    namespace {
+
+        const uint32_t localHeaderSignature = 0x04034b50;
+        const uint32_t centralHeaderSignature = 0x02014b50;
+        const uint32_t endOfCentralDirectorySignature = 0x06054b50;
+        const uint16_t versionNeeded = 20;
+        const uint16_t utf8NameFlag = 0x0800;
+
+        void PutU16(std::string &out, uint16_t value) {
+            out.push_back(static_cast<char>(value & 0xFF));
+            out.push_back(static_cast<char>(value >> 8));
+        }
+
+        void PutU32(std::string &out, uint32_t value) {
+            PutU16(out, static_cast<uint16_t>(value & 0xFFFF));
+            PutU16(out, static_cast<uint16_t>(value >> 16));
+        }
+
+        uint32_t CheckedSize(const std::string &name, size_t size) {
+            if (size > 0xFFFFFFFFu) {
+                throw O2BException(name + " is too large for a zip archive without ZIP64");
+            }
+            return static_cast<uint32_t>(size);
+        }
+
+    }
+
+    // Entries are dated when the archive is created
+    O2BZipWriter::O2BZipWriter(const std::string &path)
+        : _Path(path), _File(path, std::ios::binary), _Offset(0), _Time(0), _Date(0x21), _Closed(false) {
+        if (!_File) {
+            throw O2BException("Could not open file at " + path);
+        }
+        auto now = std::time(nullptr);
+        if (auto local = std::localtime(&now)) {
+            _Time = static_cast<uint16_t>(local->tm_hour << 11 | local->tm_min << 5 | local->tm_sec / 2);
+            _Date = static_cast<uint16_t>(std::max(local->tm_year - 80, 0) << 9 | (local->tm_mon + 1) << 5 | local->tm_mday);
+        }
+    }
+
+    bool O2BZipWriter::Claim(const std::string &name) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        return _Claimed.insert(name).second;
+    }
+
+    void O2BZipWriter::Add(const std::string &name, std::string_view data) {
+        _Entry entry;
+        entry.Name = name;
+        entry.Crc32 = _Detail::Crc32(data.data(), data.size());
+        entry.UncompressedSize = CheckedSize(name, data.size());
+        if (!IsCompressed(name)) {
+            auto deflated = _Detail::Deflate(data.data(), data.size());
+            if (deflated.size() < data.size()) {
+                entry.Method = 8;
+                entry.CompressedSize = static_cast<uint32_t>(deflated.size());
+                _Write(std::move(entry), deflated);
+                return;
+            }
+        }
+        entry.Method = 0;
+        entry.CompressedSize = entry.UncompressedSize;
+        _Write(std::move(entry), data);
+    }
+
+    void O2BZipWriter::AddFile(const std::string &name, const std::string &path) {
+        O2BMappedFile file(path);
+        Add(name, file.View());
+    }
+
+    void O2BZipWriter::AddEntry(const std::string &name, O2BZipArchive &archive, const O2BZipArchive::Entry &entry) {
+        if (entry.Method != 0 && entry.Method != 8) {
+            Add(name, archive.Read(entry));
+            return;
+        }
+        auto raw = archive.ReadVerifiedRaw(entry);
+        _Write({ name, entry.Method, entry.Crc32, entry.CompressedSize, entry.UncompressedSize, 0 }, raw);
+    }
+
+    void O2BZipWriter::Close() {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        if (_Closed) {
+            return;
+        }
+        _Closed = true;
+        auto directoryOffset = _Offset;
+        std::string directory;
+        for (const auto &entry : _Entries) {
+            PutU32(directory, centralHeaderSignature);
+            PutU16(directory, versionNeeded); // Version made by
+            PutU16(directory, versionNeeded);
+            PutU16(directory, utf8NameFlag);
+            PutU16(directory, entry.Method);
+            PutU16(directory, _Time);
+            PutU16(directory, _Date);
+            PutU32(directory, entry.Crc32);
+            PutU32(directory, entry.CompressedSize);
+            PutU32(directory, entry.UncompressedSize);
+            PutU16(directory, static_cast<uint16_t>(entry.Name.size()));
+            PutU16(directory, 0); // Extra field length
+            PutU16(directory, 0); // Comment length
+            PutU16(directory, 0); // Disk number
+            PutU16(directory, 0); // Internal attributes
+            PutU32(directory, 0); // External attributes
+            PutU32(directory, entry.LocalHeaderOffset);
+            directory += entry.Name;
+        }
+        if (_Offset + directory.size() > 0xFFFFFFFFu) {
+            throw O2BException(_Path + ": Archive is too large without ZIP64");
+        }
+        _Put(directory);
+        std::string end;
+        PutU32(end, endOfCentralDirectorySignature);
+        PutU16(end, 0); // This disk
+        PutU16(end, 0); // Disk with the central directory
+        PutU16(end, static_cast<uint16_t>(_Entries.size()));
+        PutU16(end, static_cast<uint16_t>(_Entries.size()));
+        PutU32(end, static_cast<uint32_t>(directory.size()));
+        PutU32(end, static_cast<uint32_t>(directoryOffset));
+        PutU16(end, 0); // Comment length
+        _Put(end);
+        _File.close();
+        if (!_File) {
+            throw O2BException("Could not write file at " + _Path);
+        }
+    }
+
+    bool O2BZipWriter::IsCompressed(std::string_view name) {
+        auto dot = name.rfind('.');
+        if (dot == std::string_view::npos) {
+            return false;
+        }
+        std::string extension(name.substr(dot + 1));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        for (const char *compressed : { "ogg", "mp3", "flac", "png", "jpg", "jpeg", "mp4", "avi", "flv", "wmv", "mpg", "zip" }) {
+            if (extension == compressed) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void O2BZipWriter::_Write(_Entry entry, std::string_view body) {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        if (_Closed) {
+            throw O2BException(
+                std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                + ": " + _Path + " is already closed");
+        }
+        if (_Entries.size() == 0xFFFF) {
+            throw O2BException(_Path + ": Too many entries without ZIP64");
+        }
+        if (_Offset + 30 + entry.Name.size() + body.size() > 0xFFFFFFFFu) {
+            throw O2BException(_Path + ": Archive is too large without ZIP64");
+        }
+        entry.LocalHeaderOffset = static_cast<uint32_t>(_Offset);
+        std::string header;
+        PutU32(header, localHeaderSignature);
+        PutU16(header, versionNeeded);
+        PutU16(header, utf8NameFlag);
+        PutU16(header, entry.Method);
+        PutU16(header, _Time);
+        PutU16(header, _Date);
+        PutU32(header, entry.Crc32);
+        PutU32(header, entry.CompressedSize);
+        PutU32(header, entry.UncompressedSize);
+        PutU16(header, static_cast<uint16_t>(entry.Name.size()));
+        PutU16(header, 0); // Extra field length
+        header += entry.Name;
+        _Put(header);
+        _File.write(body.data(), static_cast<std::streamsize>(body.size()));
+        _Offset += body.size();
+        if (!_File) {
+            throw O2BException("Could not write file at " + _Path);
+        }
+        _Entries.push_back(std::move(entry));
+    }
+
+    void O2BZipWriter::_Put(const std::string &bytes) {
+        _File.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        _Offset += bytes.size();
+    }
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef OSU_2_BMS_O2B_ZIP_WRITER_HPP_INCLUDED
+#define OSU_2_BMS_O2B_ZIP_WRITER_HPP_INCLUDED
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "O2BException.hpp"
+#include "O2BZipArchive.hpp"
+
+namespace Osu2Bms {
+
+    // Writes a zip archive front to back, one entry at a time. Entries are
+    // checksummed and compressed by the calling thread before the archive is
+    // locked, so several threads may add entries at once. Formats which are
+    // compressed already are stored as they are, as is anything which does
+    // not get smaller when deflated. Archives past 4 GiB or 65535 entries
+    // would need ZIP64 and are refused.
+    class O2BZipWriter {
+    public:
+        explicit O2BZipWriter(const std::string &path);
+        O2BZipWriter(const O2BZipWriter &) = delete;
+        O2BZipWriter &operator=(const O2BZipWriter &) = delete;
+    public:
+        // Reserves name for the caller; false if it was claimed before, so a
+        // file shared by several charts is only added once
+        bool Claim(const std::string &name);
+        void Add(const std::string &name, std::string_view data);
+        // The file is mapped rather than read into memory
+        void AddFile(const std::string &name, const std::string &path);
+        // Copies an entry of another archive without deflating it again; it is
+        // still inflated once to check its size and CRC-32
+        void AddEntry(const std::string &name, O2BZipArchive &archive, const O2BZipArchive::Entry &entry);
+        // Writes the central directory; nothing may be added afterwards
+        void Close();
+        static bool IsCompressed(std::string_view name);
+    private:
+        struct _Entry {
+            std::string Name;
+            uint16_t Method;
+            uint32_t Crc32;
+            uint32_t CompressedSize;
+            uint32_t UncompressedSize;
+            uint32_t LocalHeaderOffset;
+        };
+        std::string _Path;
+        std::ofstream _File;
+        std::mutex _Mutex;
+        uint64_t _Offset;
+        uint16_t _Time;
+        uint16_t _Date;
+        std::vector<_Entry> _Entries;
+        std::unordered_set<std::string> _Claimed;
+        bool _Closed;
+    private:
+        void _Write(_Entry entry, std::string_view body);
+        void _Put(const std::string &bytes);
+    };
+
+}
+
+#endif // !OSU_2_BMS_O2B_ZIP_WRITER_HPP_INCLUDED
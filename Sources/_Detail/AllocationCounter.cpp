@@ -0,0 +1,48 @@
+#include "AllocationCounter.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        namespace {
+
+            // Per thread, so batch workers only see their own allocations
+            thread_local size_t allocationCount = 0;
+
+        }
+
+        size_t AllocationCount() {
+            return allocationCount;
+        }
+
+    }
+}
+
+// The array forms forward to these by default
+
+void *operator new(std::size_t size) {
+    ++Osu2Bms::_Detail::allocationCount;
+    if (void *p = std::malloc(size != 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    ++Osu2Bms::_Detail::allocationCount;
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
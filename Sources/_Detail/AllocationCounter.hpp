@@ -0,0 +1,17 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_ALLOCATION_COUNTER_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_ALLOCATION_COUNTER_HPP_INCLUDED
+
+#include <cstddef>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // Number of times the replaceable operator new has been called on the
+        // current thread. Defined together with the replacement in AllocationCounter.cpp.
+        size_t AllocationCount();
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_ALLOCATION_COUNTER_HPP_INCLUDED
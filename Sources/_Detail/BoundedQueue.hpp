@@ -0,0 +1,65 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_BOUNDED_QUEUE_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_BOUNDED_QUEUE_HPP_INCLUDED
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // A blocking FIFO queue of limited capacity. Push waits while the queue
+        // is full, which is how producers are slowed down to the consumers' pace.
+        // After Close, Push fails and Pop drains what is left, then fails.
+        template <typename T>
+        class BoundedQueue {
+        public:
+            explicit BoundedQueue(size_t capacity)
+                : _Capacity(capacity > 0 ? capacity : 1) {}
+
+            bool Push(T value) {
+                std::unique_lock<std::mutex> lock(_Mutex);
+                _NotFull.wait(lock, [this] { return _Closed || _Items.size() < _Capacity; });
+                if (_Closed) {
+                    return false;
+                }
+                _Items.push_back(std::move(value));
+                _NotEmpty.notify_one();
+                return true;
+            }
+
+            bool Pop(T &value) {
+                std::unique_lock<std::mutex> lock(_Mutex);
+                _NotEmpty.wait(lock, [this] { return _Closed || !_Items.empty(); });
+                if (_Items.empty()) {
+                    return false;
+                }
+                value = std::move(_Items.front());
+                _Items.pop_front();
+                _NotFull.notify_one();
+                return true;
+            }
+
+            void Close() {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                _Closed = true;
+                _NotFull.notify_all();
+                _NotEmpty.notify_all();
+            }
+
+        private:
+            const size_t _Capacity;
+            std::deque<T> _Items;
+            std::mutex _Mutex;
+            std::condition_variable _NotFull;
+            std::condition_variable _NotEmpty;
+            bool _Closed = false;
+        };
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_BOUNDED_QUEUE_HPP_INCLUDED
@@ -0,0 +1,170 @@
+#include "Deflate.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        namespace {
+
+            const size_t windowSize = 32768;
+            const size_t minMatch = 3;
+            const size_t maxMatch = 258;
+            const size_t maxChain = 32;
+            const unsigned hashBits = 15;
+
+            const uint16_t lengthBases[29] = {
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            const uint8_t lengthExtras[29] = {
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            const uint16_t distanceBases[30] = {
+                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                8193, 12289, 16385, 24577 };
+            const uint8_t distanceExtras[30] = {
+                0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+            class BitWriter {
+            public:
+                explicit BitWriter(std::string &out) : _Out(out), _Buffer(0), _Count(0) {}
+
+                // Extra bits and headers go least significant bit first
+                void Bits(uint32_t value, unsigned n) {
+                    _Buffer |= static_cast<uint64_t>(value) << _Count;
+                    _Count += n;
+                    while (_Count >= 8) {
+                        _Out.push_back(static_cast<char>(_Buffer & 0xFF));
+                        _Buffer >>= 8;
+                        _Count -= 8;
+                    }
+                }
+
+                // Huffman codes go most significant bit first
+                void Code(uint32_t code, unsigned n) {
+                    uint32_t reversed = 0;
+                    for (unsigned i = 0; i < n; ++i) {
+                        reversed = reversed << 1 | (code >> i & 1);
+                    }
+                    Bits(reversed, n);
+                }
+
+                void Flush() {
+                    if (_Count > 0) {
+                        _Out.push_back(static_cast<char>(_Buffer & 0xFF));
+                    }
+                    _Buffer = 0;
+                    _Count = 0;
+                }
+
+            private:
+                std::string &_Out;
+                uint64_t _Buffer;
+                unsigned _Count;
+            };
+
+            void WriteLiteral(BitWriter &out, unsigned symbol) {
+                if (symbol < 144) {
+                    out.Code(0x30 + symbol, 8);
+                } else if (symbol < 256) {
+                    out.Code(0x190 + symbol - 144, 9);
+                } else if (symbol < 280) {
+                    out.Code(symbol - 256, 7);
+                } else {
+                    out.Code(0xC0 + symbol - 280, 8);
+                }
+            }
+
+            void WriteMatch(BitWriter &out, size_t length, size_t distance) {
+                auto l = static_cast<size_t>(std::upper_bound(lengthBases, lengthBases + 29, length) - lengthBases - 1);
+                // 258 has a code of its own rather than being 227 + 31
+                if (length == maxMatch) {
+                    l = 28;
+                }
+                WriteLiteral(out, static_cast<unsigned>(257 + l));
+                out.Bits(static_cast<uint32_t>(length - lengthBases[l]), lengthExtras[l]);
+                auto d = static_cast<size_t>(std::upper_bound(distanceBases, distanceBases + 30, distance) - distanceBases - 1);
+                out.Code(static_cast<uint32_t>(d), 5);
+                out.Bits(static_cast<uint32_t>(distance - distanceBases[d]), distanceExtras[d]);
+            }
+
+            uint32_t HashAt(const uint8_t *p) {
+                uint32_t v = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+                    | static_cast<uint32_t>(p[2]) << 16;
+                return (v * 2654435761u) >> (32 - hashBits);
+            }
+
+        }
+
+        std::string Deflate(const char *data, size_t size) {
+            auto bytes = reinterpret_cast<const uint8_t *>(data);
+            std::string result;
+            result.reserve(size / 4 + 64);
+            BitWriter out(result);
+            out.Bits(1, 1); // BFINAL
+            out.Bits(1, 2); // BTYPE 01, fixed Huffman codes
+            // Positions + 1, so that 0 marks an empty chain
+            std::vector<uint32_t> head(size_t(1) << hashBits, 0);
+            std::vector<uint32_t> previous(windowSize, 0);
+            auto insert = [&](size_t position) {
+                auto hash = HashAt(bytes + position);
+                previous[position % windowSize] = head[hash];
+                head[hash] = static_cast<uint32_t>(position + 1);
+            };
+            size_t i = 0;
+            while (i < size) {
+                size_t bestLength = 0;
+                size_t bestDistance = 0;
+                if (size - i >= minMatch) {
+                    auto limit = std::min(maxMatch, size - i);
+                    auto candidate = head[HashAt(bytes + i)];
+                    for (size_t chain = 0; candidate != 0 && chain < maxChain; ++chain) {
+                        size_t from = candidate - 1;
+                        if (i - from > windowSize) {
+                            break;
+                        }
+                        size_t length = 0;
+                        while (length < limit && bytes[from + length] == bytes[i + length]) {
+                            ++length;
+                        }
+                        if (length > bestLength) {
+                            bestLength = length;
+                            bestDistance = i - from;
+                            if (length == limit) {
+                                break;
+                            }
+                        }
+                        auto next = previous[from % windowSize];
+                        // An older entry overwritten in the ring would point forward
+                        if (next == 0 || next - 1 >= from) {
+                            break;
+                        }
+                        candidate = next;
+                    }
+                }
+                if (bestLength >= minMatch) {
+                    WriteMatch(out, bestLength, bestDistance);
+                    for (size_t end = i + bestLength; i < end; ++i) {
+                        if (size - i >= minMatch) {
+                            insert(i);
+                        }
+                    }
+                } else {
+                    WriteLiteral(out, bytes[i]);
+                    if (size - i >= minMatch) {
+                        insert(i);
+                    }
+                    ++i;
+                }
+            }
+            WriteLiteral(out, 256);
+            out.Flush();
+            return result;
+        }
+
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_DEFLATE_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_DEFLATE_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // Encodes data as a raw DEFLATE stream (RFC 1951) of one block with
+        // the fixed Huffman codes. Matches are found through hash chains of
+        // bounded length, which suits the long runs of zeros in BMS text.
+        // The result may be larger than data when it does not compress.
+        std::string Deflate(const char *data, size_t size);
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_DEFLATE_HPP_INCLUDED
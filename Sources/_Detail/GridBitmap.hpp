@@ -0,0 +1,70 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_GRID_BITMAP_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_GRID_BITMAP_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        inline unsigned CountTrailingZeros(uint64_t word) {
+#if defined(__GNUC__)
+            return static_cast<unsigned>(__builtin_ctzll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanForward64(&index, word);
+            return static_cast<unsigned>(index);
+#else
+            unsigned n = 0;
+            while (!(word & 1)) {
+                word >>= 1;
+                ++n;
+            }
+            return n;
+#endif
+        }
+
+        // Occupancy of the 256 possible grid indices of a section
+        class GridBitmap {
+        public:
+            static const size_t Capacity = 256;
+
+            void Set(size_t i) {
+                _Words[i >> 6] |= uint64_t(1) << (i & 63);
+            }
+
+            bool Test(size_t i) const {
+                return (_Words[i >> 6] >> (i & 63)) & 1;
+            }
+
+            bool Any() const {
+                return (_Words[0] | _Words[1] | _Words[2] | _Words[3]) != 0;
+            }
+
+            void Clear() {
+                _Words[0] = _Words[1] = _Words[2] = _Words[3] = 0;
+            }
+
+            // Calls f(index) for every set index in ascending order
+            template <typename F>
+            void ForEach(F f) const {
+                for (size_t w = 0; w < 4; ++w) {
+                    for (uint64_t word = _Words[w]; word != 0; word &= word - 1) {
+                        f(w * 64 + CountTrailingZeros(word));
+                    }
+                }
+            }
+
+        private:
+            uint64_t _Words[4] = {};
+        };
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_GRID_BITMAP_HPP_INCLUDED
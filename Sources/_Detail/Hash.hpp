@@ -0,0 +1,43 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_HASH_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_HASH_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        inline uint64_t Mix64(uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        // Non-cryptographic hash consuming 8 bytes per step. Different seeds
+        // give practically independent hashes of the same data.
+        inline uint64_t Hash64(const char *data, size_t size, uint64_t seed = 0) {
+            const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+            uint64_t h = seed ^ (size * multiplier);
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, 8);
+                h = (h ^ Mix64(word)) * multiplier;
+                h = (h << 27) | (h >> 37);
+            }
+            uint64_t tail = 0;
+            for (size_t shift = 0; i < size; ++i, shift += 8) {
+                tail |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << shift;
+            }
+            return Mix64(h ^ Mix64(tail));
+        }
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_HASH_HPP_INCLUDED
@@ -0,0 +1,275 @@
+#include "Inflate.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "../O2BException.hpp"
+#include "Utilities.hpp"
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        namespace {
+
+            const uint16_t lengthBases[29] = {
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            const uint8_t lengthExtras[29] = {
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            const uint16_t distanceBases[30] = {
+                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                8193, 12289, 16385, 24577 };
+            const uint8_t distanceExtras[30] = {
+                0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+            const uint8_t codeLengthOrder[19] = {
+                16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+            [[noreturn]] void Corrupted(const char *what) {
+                throw O2BException(std::string("in ") + OSU_2_BMS_FUNCTION_SIGNATURE
+                    + ": Corrupted DEFLATE stream, " + what);
+            }
+
+            // Canonical Huffman code, decoded one bit at a time by code length
+            struct Huffman {
+                std::array<uint16_t, 16> Count;
+                std::array<uint16_t, 288> Symbol;
+
+                void Build(const uint8_t *lengths, size_t n) {
+                    Count.fill(0);
+                    for (size_t i = 0; i < n; ++i) {
+                        ++Count[lengths[i]];
+                    }
+                    std::array<uint16_t, 16> offsets;
+                    offsets[1] = 0;
+                    for (size_t len = 1; len < 15; ++len) {
+                        offsets[len + 1] = offsets[len] + Count[len];
+                    }
+                    for (size_t i = 0; i < n; ++i) {
+                        if (lengths[i] != 0) {
+                            Symbol[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+                        }
+                    }
+                }
+            };
+
+            class BitReader {
+            public:
+                BitReader(const uint8_t *data, size_t size)
+                    : _Data(data), _Size(size), _Position(0), _Buffer(0), _Count(0) {}
+
+                uint32_t Bits(unsigned n) {
+                    while (_Count < n) {
+                        if (_Position == _Size) {
+                            Corrupted("unexpected end of data");
+                        }
+                        _Buffer |= static_cast<uint64_t>(_Data[_Position++]) << _Count;
+                        _Count += 8;
+                    }
+                    auto value = static_cast<uint32_t>(_Buffer & ((uint64_t(1) << n) - 1));
+                    _Buffer >>= n;
+                    _Count -= n;
+                    return value;
+                }
+
+                int Decode(const Huffman &h) {
+                    int code = 0, first = 0, index = 0;
+                    for (size_t len = 1; len < 16; ++len) {
+                        code |= static_cast<int>(Bits(1));
+                        int count = h.Count[len];
+                        if (code - count < first) {
+                            return h.Symbol[index + (code - first)];
+                        }
+                        index += count;
+                        first = (first + count) << 1;
+                        code <<= 1;
+                    }
+                    Corrupted("invalid Huffman code");
+                }
+
+                // Discards the remaining bits of the current byte
+                void Align() {
+                    _Buffer = 0;
+                    _Count = 0;
+                }
+
+                const uint8_t *Take(size_t n) {
+                    if (_Size - _Position < n) {
+                        Corrupted("unexpected end of data");
+                    }
+                    auto p = _Data + _Position;
+                    _Position += n;
+                    return p;
+                }
+
+            private:
+                const uint8_t *_Data;
+                size_t _Size;
+                size_t _Position;
+                uint64_t _Buffer;
+                unsigned _Count;
+            };
+
+            void InflateCodes(
+                BitReader &in, std::string &out, size_t limit, const Huffman &lengths, const Huffman &distances) {
+                for (;;) {
+                    int symbol = in.Decode(lengths);
+                    if (symbol < 256) {
+                        if (out.size() == limit) {
+                            Corrupted("output exceeds declared size");
+                        }
+                        out.push_back(static_cast<char>(symbol));
+                    } else if (symbol == 256) {
+                        return;
+                    } else {
+                        symbol -= 257;
+                        if (symbol >= 29) {
+                            Corrupted("invalid length symbol");
+                        }
+                        size_t length = lengthBases[symbol] + in.Bits(lengthExtras[symbol]);
+                        int distanceSymbol = in.Decode(distances);
+                        if (distanceSymbol >= 30) {
+                            Corrupted("invalid distance symbol");
+                        }
+                        size_t distance = distanceBases[distanceSymbol] + in.Bits(distanceExtras[distanceSymbol]);
+                        if (distance > out.size()) {
+                            Corrupted("distance too far back");
+                        }
+                        if (length > limit - out.size()) {
+                            Corrupted("output exceeds declared size");
+                        }
+                        size_t from = out.size() - distance;
+                        for (size_t i = 0; i < length; ++i) {
+                            out.push_back(out[from + i]);
+                        }
+                    }
+                }
+            }
+
+            void BuildFixed(Huffman &lengths, Huffman &distances) {
+                uint8_t l[288];
+                size_t i = 0;
+                for (; i < 144; ++i) l[i] = 8;
+                for (; i < 256; ++i) l[i] = 9;
+                for (; i < 280; ++i) l[i] = 7;
+                for (; i < 288; ++i) l[i] = 8;
+                lengths.Build(l, 288);
+                uint8_t d[30];
+                for (i = 0; i < 30; ++i) d[i] = 5;
+                distances.Build(d, 30);
+            }
+
+            void BuildDynamic(BitReader &in, Huffman &lengths, Huffman &distances) {
+                size_t literalCount = in.Bits(5) + 257;
+                size_t distanceCount = in.Bits(5) + 1;
+                size_t codeCount = in.Bits(4) + 4;
+                if (literalCount > 286 || distanceCount > 30) {
+                    Corrupted("too many codes");
+                }
+                uint8_t l[320] = {};
+                for (size_t i = 0; i < codeCount; ++i) {
+                    l[codeLengthOrder[i]] = static_cast<uint8_t>(in.Bits(3));
+                }
+                Huffman codeLengths;
+                codeLengths.Build(l, 19);
+                size_t i = 0;
+                while (i < literalCount + distanceCount) {
+                    int symbol = in.Decode(codeLengths);
+                    if (symbol < 16) {
+                        l[i++] = static_cast<uint8_t>(symbol);
+                        continue;
+                    }
+                    uint8_t value = 0;
+                    size_t repeat;
+                    if (symbol == 16) {
+                        if (i == 0) {
+                            Corrupted("repeat with no previous length");
+                        }
+                        value = l[i - 1];
+                        repeat = 3 + in.Bits(2);
+                    } else if (symbol == 17) {
+                        repeat = 3 + in.Bits(3);
+                    } else {
+                        repeat = 11 + in.Bits(7);
+                    }
+                    if (i + repeat > literalCount + distanceCount) {
+                        Corrupted("too many lengths");
+                    }
+                    while (repeat--) {
+                        l[i++] = value;
+                    }
+                }
+                if (l[256] == 0) {
+                    Corrupted("missing end-of-block code");
+                }
+                lengths.Build(l, literalCount);
+                distances.Build(l + literalCount, distanceCount);
+            }
+
+            std::array<uint32_t, 256> MakeCrcTable() {
+                std::array<uint32_t, 256> table;
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    table[i] = c;
+                }
+                return table;
+            }
+
+        }
+
+        std::string Inflate(const char *data, size_t size, size_t limit) {
+            BitReader in(reinterpret_cast<const uint8_t *>(data), size);
+            std::string out;
+            // DEFLATE expands at most 1032 times, so a false limit cannot
+            // make this reserve more than the data could produce
+            out.reserve(std::min(limit, size <= SIZE_MAX / 1032 ? size * 1032 : SIZE_MAX));
+            Huffman lengths, distances;
+            bool last;
+            do {
+                last = in.Bits(1) != 0;
+                switch (in.Bits(2)) {
+                case 0: {
+                    in.Align();
+                    auto header = in.Take(4);
+                    uint16_t len = static_cast<uint16_t>(header[0] | header[1] << 8);
+                    uint16_t nlen = static_cast<uint16_t>(header[2] | header[3] << 8);
+                    if (len != static_cast<uint16_t>(~nlen)) {
+                        Corrupted("stored block length mismatched");
+                    }
+                    if (len > limit - out.size()) {
+                        Corrupted("output exceeds declared size");
+                    }
+                    out.append(reinterpret_cast<const char *>(in.Take(len)), len);
+                    break;
+                }
+                case 1:
+                    BuildFixed(lengths, distances);
+                    InflateCodes(in, out, limit, lengths, distances);
+                    break;
+                case 2:
+                    BuildDynamic(in, lengths, distances);
+                    InflateCodes(in, out, limit, lengths, distances);
+                    break;
+                default:
+                    Corrupted("invalid block type");
+                }
+            } while (!last);
+            return out;
+        }
+
+        uint32_t Crc32(const char *data, size_t size, uint32_t crc) {
+            static const auto table = MakeCrcTable();
+            crc = ~crc;
+            for (size_t i = 0; i < size; ++i) {
+                crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_INFLATE_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_INFLATE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // Decodes a raw DEFLATE stream (RFC 1951), as stored in zip entries.
+        // The output may not exceed limit, such as the size a zip entry
+        // declares, so a small archive cannot claim unbounded memory.
+        // Throws O2BException on malformed input.
+        std::string Inflate(const char *data, size_t size, size_t limit = SIZE_MAX);
+
+        // Standard CRC-32 (IEEE 802.3), continued from crc.
+        uint32_t Crc32(const char *data, size_t size, uint32_t crc = 0);
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_INFLATE_HPP_INCLUDED
@@ -0,0 +1,156 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_INTERN_TABLE_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_INTERN_TABLE_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Hash.hpp"
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // Deduplicates values in one pass and hands out 1-based IDs.
+        // Insert() returns a provisional ID in insertion order. After Finalize()
+        // the values are sorted, IDs follow the sorted order, and both IdOf()
+        // and Resolve() map to the final ID in O(1).
+        // The index is an open-addressing table of IDs, and Clear() keeps every
+        // buffer as well as the storage of the values themselves, so a reused
+        // table stops allocating once it has seen its largest input.
+        template <typename T, typename Hash = std::hash<T>>
+        class InternTable {
+        public:
+            // value may be of any type comparable with T which Hash accepts
+            template <typename K>
+            size_t Insert(const K &value) {
+                if ((_Size + 1) * 2 > _Slots.size()) {
+                    _Grow();
+                }
+                const size_t mask = _Slots.size() - 1;
+                for (size_t i = _SlotOf(value) & mask;; i = (i + 1) & mask) {
+                    auto id = _Slots[i];
+                    if (id == 0) {
+                        if (_Size < _Values.size()) {
+                            _Values[_Size] = value;
+                        } else {
+                            _Values.emplace_back(value);
+                        }
+                        _Slots[i] = static_cast<uint32_t>(++_Size);
+                        return _Size;
+                    }
+                    if (_Values[id - 1] == value) {
+                        return id;
+                    }
+                }
+            }
+
+            void Finalize() {
+                _Order.resize(_Size);
+                std::iota(_Order.begin(), _Order.end(), 0);
+                std::sort(_Order.begin(), _Order.end(), [this](uint32_t lhs, uint32_t rhs) {
+                    return _Values[lhs] < _Values[rhs];
+                });
+                _Remap.assign(_Size + 1, 0);
+                for (size_t i = 0; i < _Size; ++i) {
+                    _Remap[_Order[i] + 1] = static_cast<uint32_t>(i + 1);
+                }
+                // Moves every value to its sorted place by following the
+                // permutation's cycles, so strings are swapped, never copied
+                for (size_t i = 0; i < _Size; ++i) {
+                    _Order[i] = _Remap[i + 1] - 1;
+                }
+                for (size_t i = 0; i < _Size; ++i) {
+                    while (_Order[i] != i) {
+                        auto j = _Order[i];
+                        std::swap(_Values[i], _Values[j]);
+                        std::swap(_Order[i], _Order[j]);
+                    }
+                }
+                for (auto &id : _Slots) {
+                    id = _Remap[id];
+                }
+            }
+
+            template <typename K>
+            size_t IdOf(const K &value) const {
+                if (_Slots.empty()) {
+                    throw std::out_of_range("InternTable::IdOf");
+                }
+                const size_t mask = _Slots.size() - 1;
+                for (size_t i = _SlotOf(value) & mask;; i = (i + 1) & mask) {
+                    auto id = _Slots[i];
+                    if (id == 0) {
+                        throw std::out_of_range("InternTable::IdOf");
+                    }
+                    if (_Values[id - 1] == value) {
+                        return id;
+                    }
+                }
+            }
+
+            size_t Resolve(size_t provisionalId) const {
+                return _Remap[provisionalId];
+            }
+
+            const T &Value(size_t id) const {
+                return _Values[id - 1];
+            }
+
+            size_t Size() const {
+                return _Size;
+            }
+
+            void Reserve(size_t n) {
+                while (n * 2 > _Slots.size()) {
+                    _Grow();
+                }
+                _Values.reserve(n);
+            }
+
+            void Clear() {
+                std::fill(_Slots.begin(), _Slots.end(), 0);
+                _Remap.clear();
+                _Size = 0;
+            }
+
+        private:
+            Hash _Hash;
+            std::vector<uint32_t> _Slots; // 0 for empty, otherwise an ID; size is a power of 2
+            std::vector<T> _Values; // Only the first _Size are in use
+            std::vector<uint32_t> _Remap; // _Remap[0] is 0, so empty slots stay empty
+            std::vector<uint32_t> _Order;
+            size_t _Size = 0;
+
+            // std::hash of a double is its bit pattern, whose low bits are
+            // mostly zero for round BPM values, so the hash is mixed first
+            template <typename K>
+            size_t _SlotOf(const K &value) const {
+                return static_cast<size_t>(Mix64(_Hash(value)));
+            }
+
+            void _Grow() {
+                std::vector<uint32_t> slots(_Slots.empty() ? 16 : _Slots.size() * 2, 0);
+                const size_t mask = slots.size() - 1;
+                for (auto id : _Slots) {
+                    if (id != 0) {
+                        size_t i = _SlotOf(_Values[id - 1]) & mask;
+                        while (slots[i] != 0) {
+                            i = (i + 1) & mask;
+                        }
+                        slots[i] = id;
+                    }
+                }
+                _Slots.swap(slots);
+            }
+        };
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_INTERN_TABLE_HPP_INCLUDED
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_RADIX_SORT_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_RADIX_SORT_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        // Computes the stable ascending order of keys with an LSD radix sort
+        // over 11-bit digits. Passes whose digit is shared by every key are
+        // skipped, so typical millisecond timestamps need one or two passes.
+        // order receives the permutation; scratch is reused working storage.
+        inline void StableRadixOrder(
+            const std::vector<int32_t> &keys,
+            std::vector<uint32_t> &order,
+            std::vector<uint32_t> &scratch) {
+            const size_t n = keys.size();
+            order.resize(n);
+            std::iota(order.begin(), order.end(), 0);
+            if (n < 2) {
+                return;
+            }
+            scratch.resize(n);
+            const uint32_t bias = 0x80000000u;
+            for (unsigned shift = 0; shift < 32; shift += 11) {
+                std::array<uint32_t, 2048> counts = {};
+                for (size_t i = 0; i < n; ++i) {
+                    ++counts[((static_cast<uint32_t>(keys[i]) ^ bias) >> shift) & 0x7FF];
+                }
+                auto first = ((static_cast<uint32_t>(keys[0]) ^ bias) >> shift) & 0x7FF;
+                if (counts[first] == n) {
+                    continue;
+                }
+                uint32_t sum = 0;
+                for (auto &count : counts) {
+                    auto c = count;
+                    count = sum;
+                    sum += c;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    auto index = order[i];
+                    scratch[counts[((static_cast<uint32_t>(keys[index]) ^ bias) >> shift) & 0x7FF]++] = index;
+                }
+                order.swap(scratch);
+            }
+        }
+
+        // Reorders values so that values[i] becomes old values[order[i]]
+        template <typename T>
+        void ApplyOrder(std::vector<T> &values, const std::vector<uint32_t> &order, std::vector<T> &scratch) {
+            scratch.resize(values.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                scratch[i] = values[order[i]];
+            }
+            values.swap(scratch);
+        }
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_RADIX_SORT_HPP_INCLUDED
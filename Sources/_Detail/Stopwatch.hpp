@@ -0,0 +1,30 @@
+#pragma once
+#ifndef OSU_2_BMS__DETAIL_STOPWATCH_HPP_INCLUDED
+#define OSU_2_BMS__DETAIL_STOPWATCH_HPP_INCLUDED
+
+#include <chrono>
+
+namespace Osu2Bms {
+    namespace _Detail {
+
+        class Stopwatch {
+        public:
+            Stopwatch()
+                : _Start(std::chrono::steady_clock::now()) {}
+
+            // Milliseconds since construction or the previous Lap
+            double Lap() {
+                auto now = std::chrono::steady_clock::now();
+                std::chrono::duration<double, std::milli> elapsed = now - _Start;
+                _Start = now;
+                return elapsed.count();
+            }
+
+        private:
+            std::chrono::steady_clock::time_point _Start;
+        };
+
+    }
+}
+
+#endif // !OSU_2_BMS__DETAIL_STOPWATCH_HPP_INCLUDED
@@ -1,9 +1,22 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/any.hpp>
@@ -11,8 +24,24 @@
 
 #include "Bms.hpp"
 #include "Osu.hpp"
+#include "O2BCache.hpp"
+#include "O2BChart.hpp"
+#include "O2BChartParser.hpp"
 #include "O2BConverter.hpp"
+#include "O2BConvertionReport.hpp"
+#include "O2BDirectoryWatcher.hpp"
 #include "O2BException.hpp"
+#include "O2BMappedFile.hpp"
+#include "O2BMetrics.hpp"
+#include "O2BResourceIndex.hpp"
+#include "O2BServer.hpp"
+#include "O2BSocket.hpp"
+#include "O2BThreadPool.hpp"
+#include "O2BZipArchive.hpp"
+#include "O2BZipWriter.hpp"
+#include "_Detail/BoundedQueue.hpp"
+#include "_Detail/Hash.hpp"
+#include "_Detail/Stopwatch.hpp"
 
 using namespace std;
 using namespace experimental::filesystem;
@@ -25,13 +54,41 @@ using namespace Osu2Bms;
 options_description allOptions("options");
 options_description visibleOptions("Usage: osu2bms <input-file> [<output-file>] [options]");
 
+// One entry per converted file, collected for --profile
+struct ProfileEntry {
+    string InputPath;
+    string OutputPath;
+    double ParseMilliseconds;
+    double TotalMilliseconds;
+    O2BConvertionReport Report;
+};
+mutex profileMutex;
+vector<ProfileEntry> profileEntries;
+
+// Set by --cache-dir
+unique_ptr<O2BCache> cache;
+
+// Set by --metrics, and filled in wherever charts are converted
+unique_ptr<O2BMetrics> metrics;
+
+// Builds the sections of long charts in parallel. Only set where one chart
+// at a time is waited for; in batch mode whole files keep every core busy.
+unique_ptr<O2BThreadPool> sectionPool;
+
+// First field of every request sent to a --serve server
+const char *const protocolVersion = "osu2bms/1";
+
 // Should just be called once
 void InitializeOptions() {
     // Make options description
     options_description generic("generic options");
     generic.add_options()
         ("help", "show help message")
-        ("version,v", "show version information");
+        ("version,v", "show version information")
+        ("quiet,q", "only print errors")
+        ("profile", value<string>(), "write timings and counters of every conversion to a JSON file")
+        ("metrics", value<string>(), "keep a Prometheus text snapshot of conversion throughput, latencies and failures in this file")
+        ("metrics-interval", value<int>()->default_value(10), "seconds between --metrics snapshots");
     options_description config("configuration");
     config.add_options()
         ("bpm", value<double>(), "required by --no-timing-points, manually provide BPM value")
@@ -39,19 +96,47 @@ void InitializeOptions() {
         ("key-map-default", "use default BMS key definations")
         ("key-map-o2mania", "use BMS key definations in O2Mania")
         ("max-grid-size", value<int>()->default_value(192), "maximum grid partition size, [1, 255]")
+        ("grid-tolerance", value<double>()->default_value(1), "milliseconds a note may move to fit a smaller grid, [0, inf)")
         ("meter", value<int>()->default_value(4), "required by --no-timing-points, manually provide meter value")
         ("no-bga", "ignore BGAs")
         ("no-event-sounds", "ignore background sounds")
         ("no-inherited-timing-points", "ignore inherited timing points")
+        ("bpm-tolerance", value<double>()->default_value(0), "drop BPM changes within this ratio of the current BPM and snap BPMs to steps of it, [0, 1)")
+        ("max-bpm-count", value<int>()->default_value(0), "widen --bpm-tolerance until at most this many distinct BPMs remain, 0 for no limit")
         ("no-key-sounds", "ignore key sounds")
         ("no-timing-points", "ignore timing points")
-        ("offset", value<double>()->default_value(0.5), "an offset value of all notes, [0, 1)");
+        ("offset", value<double>()->default_value(0.5), "an offset value of all notes, [0, 1)")
+        ("base", value<int>()->default_value(36), "base of reference IDs, 36 or 62 (writes #BASE 62, for players which support it)")
+        ("reuse-wav-ids", "redefine #WAV IDs over the course of the chart if there are more samples than IDs");
+    options_description batch("batch mode (input is a directory or a .txt list of .osu/.osz files)");
+    batch.add_options()
+        ("output-dir,o", value<string>(), "directory to write converted files to, also used for .osz input")
+        ("set", "convert the difficulties of each .osz archive as one set sharing #WAV and #BMP IDs")
+        ("jobs,j", value<int>()->default_value(0), "number of worker threads, 0 for the number of cores")
+        ("read-jobs", value<int>()->default_value(1), "number of threads reading and inflating input files")
+        ("parse-jobs", value<int>()->default_value(0), "number of threads parsing charts, 0 for --jobs")
+        ("convert-jobs", value<int>()->default_value(0), "number of threads converting charts, 0 for --jobs")
+        ("write-jobs", value<int>()->default_value(1), "number of threads writing output files")
+        ("pack", value<string>(), "write the converted charts and the files they refer to into this zip archive instead of to disk");
+    options_description watch("watch mode");
+    watch.add_options()
+        ("watch,w", value<string>(), "keep converting .osu files in this directory whenever they change")
+        ("debounce", value<int>()->default_value(20), "milliseconds to wait for more changes before converting");
+    options_description caching("caching");
+    caching.add_options()
+        ("cache-dir", value<string>(), "reuse earlier conversions of unchanged files stored in this directory")
+        ("cache-size", value<int>()->default_value(1024), "maximum size of the cache directory in MiB");
+    options_description server("server mode (single .osu files only, - reads the chart from stdin)");
+    server.add_options()
+        ("serve", value<string>(), "keep running and convert requests sent to this Unix domain socket on --jobs workers")
+        ("queue-size", value<int>()->default_value(64), "connections which may wait for a worker before new ones are held back")
+        ("connect", value<string>(), "convert through the server listening on this socket");
     options_description hidden("hidden options");
     hidden.add_options()
         ("input-file", value<string>(), "path to osu! beatmap file")
         ("output-file", value<string>(), "path to BMS beatmap file");
-    allOptions.add(generic).add(config).add(hidden);
-    visibleOptions.add(generic).add(config);
+    allOptions.add(generic).add(config).add(batch).add(watch).add(caching).add(server).add(hidden);
+    visibleOptions.add(generic).add(config).add(batch).add(watch).add(caching).add(server);
 }
 
 variables_map ParseArguments(const size_t argc, const char *argv[]) {
@@ -74,111 +159,1209 @@ variables_map ParseArguments(const size_t argc, const char *argv[]) {
     return move(vm);
 }
 
-int main(int argc, const char *argv[]) {
+bool HasExtension(const string &path, const string &extension) {
+    auto len = path.length();
+    auto extLen = extension.length();
+    return len >= extLen && path.substr(len - extLen) == extension;
+}
+
+// Options which do not depend on the beatmap, validated once per run
+O2BConvertionOptions MakeOptions(const variables_map &vm) {
+    O2BConvertionOptions options;
+    if (vm.count("key-map")) {
+        auto &channels = vm["key-map"].as<vector<int>>();
+        for (auto channel : channels) {
+            if (channel < 11 || channel > 19) {
+                throw O2BException("Key channels should be in range [11, 19]");
+            }
+            options.KeyMap.push_back(static_cast<BmsChannelId>(channel));
+        }
+    }
+    if (vm.count("key-map-o2mania") && !options.KeyMap.empty()) {
+        throw O2BException("Key maps are in conflict.");
+    }
+    if (vm.count("key-map-default") && (!options.KeyMap.empty() || vm.count("key-map-o2mania"))) {
+        throw O2BException("Key maps are in conflict.");
+    }
+    auto gridSize = vm["max-grid-size"].as<int>();
+    if (gridSize <= 0 || gridSize >= 256) {
+        throw O2BException("Maximum grid partition size should be in range [1, 255]");
+    }
+    options.GridSize = static_cast<uint8_t>(gridSize);
+    options.GridTolerance = vm["grid-tolerance"].as<double>();
+    if (options.GridTolerance < 0) {
+        throw O2BException("Grid tolerance must not be negative");
+    }
+    options.WithBga = vm.count("no-bga") == 0;
+    options.WithEventSounds = vm.count("no-event-sounds") == 0;
+    options.WithInheritedTimingPoints = vm.count("no-inherited-timing-points") == 0;
+    options.WithKeySounds = vm.count("no-key-sounds") == 0;
+    options.BpmTolerance = vm["bpm-tolerance"].as<double>();
+    if (options.BpmTolerance < 0 || options.BpmTolerance >= 1) {
+        throw O2BException("BPM tolerance should be in range [0, 1)");
+    }
+    auto maxBpmCount = vm["max-bpm-count"].as<int>();
+    if (maxBpmCount < 0) {
+        throw O2BException("Maximum BPM count must not be negative");
+    }
+    options.MaxBpmCount = static_cast<size_t>(maxBpmCount);
+    options.WithTimingPoints = vm.count("no-timing-points") == 0;
+    if (!options.WithTimingPoints) {
+        if (!vm.count("bpm")) {
+            throw O2BException("BPM must be provided if --no-timing-points is set");
+        }
+        options.CustomBpm = vm["bpm"].as<double>();
+        if (options.CustomBpm <= 0) {
+            throw O2BException("BPM value must be greater than 0");
+        }
+        auto meter = vm["meter"].as<int>();
+        if (meter <= 0) {
+            throw O2BException("Meter value must be greater than 0");
+        }
+        options.CustomMeter = static_cast<uint8_t>(meter);
+    }
+    options.Offset = vm["offset"].as<double>();
+    auto base = vm["base"].as<int>();
+    if (base != 36 && base != 62) {
+        throw O2BException("Reference ID base should be 36 or 62");
+    }
+    options.ReferenceBase = static_cast<uint8_t>(base);
+    options.WithWavRedefinition = vm.count("reuse-wav-ids") != 0;
+    return options;
+}
+
+// Fills in the key map if it was not given explicitly, which depends on the key count
+void ApplyKeyMap(O2BConvertionOptions &options, const variables_map &vm, uint8_t keyCount) {
+    if (!vm.count("key-map")) {
+        options.KeyMap = GetBmsChannels(keyCount, false, true, vm.count("key-map-o2mania") != 0);
+    }
+}
+
+// Options only vary with the key count within a run, so every thread keeps
+// one resident converter per key count
+const O2BConverter &ConverterFor(const O2BConvertionOptions &baseOptions, const variables_map &vm, uint8_t keyCount) {
+    static thread_local unordered_map<uint8_t, unique_ptr<O2BConverter>> converters;
+    auto &converter = converters[keyCount];
+    if (!converter) {
+        auto options = baseOptions;
+        ApplyKeyMap(options, vm, keyCount);
+        converter = make_unique<O2BConverter>(options, sectionPool.get());
+    }
+    return *converter;
+}
+
+// One line per file, written at once so that lines from batch workers do not interleave
+string ReportLine(const string &outputPath, const O2BConvertionReport &report) {
+    ostringstream ss;
+    ss << outputPath << ": timing error max " << report.MaxTimingError
+        << " ms, mean " << report.MeanTimingError << " ms";
+    if (report.OffGridNoteCount > 0) {
+        ss << ", " << report.OffGridNoteCount << " of " << report.NoteCount << " notes off grid";
+    }
+    if (report.WavRedefinitionCount > 0) {
+        ss << ", " << report.WavCount << " samples on " << report.WavIdCount << " WAV IDs";
+    }
+    if (report.BpmChangeCount < report.RawBpmChangeCount) {
+        ss << ", " << report.BpmChangeCount << " of " << report.RawBpmChangeCount << " BPM changes kept"
+            << " (" << report.BpmCount << " of " << report.RawBpmCount << " BPMs)";
+    }
+    ss << '\n';
+    return ss.str();
+}
+
+// Everything besides the input which the output depends on, for O2BCache::Key.
+// The key map is resolved from the parsed beatmap, so only the flags it is
+// resolved from are covered.
+string CacheParameters(const O2BConvertionOptions &baseOptions, const variables_map &vm) {
+    auto parameters = O2BCache::SerializeOptions(baseOptions);
+    parameters += vm.count("key-map-o2mania") ? ";o2mania" : "";
+    return parameters;
+}
+
+void ConvertSource(
+    string_view source,
+    const string &inputPath,
+    const string &outputPath,
+    const O2BConvertionOptions &baseOptions,
+    const variables_map &vm) {
+    string key;
+    if (cache) {
+        key = O2BCache::Key(source, CacheParameters(baseOptions, vm));
+        if (cache->Fetch(key, outputPath)) {
+            if (metrics) {
+                metrics->CountCachedChart();
+            }
+            if (!vm.count("quiet")) {
+                cout << (outputPath + ": up to date\n");
+            }
+            return;
+        }
+    }
+    _Detail::Stopwatch stopwatch;
+    // Reused by every file this thread converts
+    static thread_local O2BChart chart;
+    O2BChartParser parse;
+    parse(source, chart);
+    auto parseMilliseconds = stopwatch.Lap();
+    const auto &convert = ConverterFor(baseOptions, vm, chart.KeyCount);
+    // Written aside and renamed over the output, so a failed conversion
+    // leaves the last good chart in place
+    auto temporary = outputPath + ".tmp";
+    O2BConvertionReport report;
+    size_t outputBytes = 0;
     try {
-        InitializeOptions();
-        auto vm = ParseArguments(argc, argv);
-        if (vm.count("help")) {
-            cout << visibleOptions << endl;
-            return EXIT_SUCCESS;
+        ofstream fout(temporary);
+        if (!fout) {
+            throw O2BException("Could not open file at " + temporary);
         }
-        if (vm.count("version")) {
-            cout << "osu2bms version v0.0.1-alpha" << endl;
-            return EXIT_SUCCESS;
+        convert(chart, fout, &report);
+        outputBytes = static_cast<size_t>(fout.tellp());
+        fout.close();
+        if (!fout) {
+            throw O2BException("Could not write file at " + temporary);
         }
-        ifstream fin;
-        ofstream fout;
-        string outputPath;
-        if (!vm.count("input-file")) {
-            throw O2BException("No input file");
+    } catch (...) {
+        std::remove(temporary.c_str());
+        throw;
+    }
+#if defined(_WIN32)
+    std::remove(outputPath.c_str());
+#endif
+    if (std::rename(temporary.c_str(), outputPath.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw O2BException("Could not write file at " + outputPath);
+    }
+    auto totalMilliseconds = parseMilliseconds + stopwatch.Lap();
+    if (cache) {
+        cache->Store(key, outputPath);
+    }
+    if (metrics) {
+        metrics->ObserveConverterStages(report.Stages);
+        metrics->CountChart(source.size(), outputBytes);
+    }
+    if (vm.count("profile")) {
+        lock_guard<mutex> lock(profileMutex);
+        profileEntries.push_back({ inputPath, outputPath, parseMilliseconds, totalMilliseconds, report });
+    }
+    if (!vm.count("quiet")) {
+        cout << ReportLine(outputPath, report);
+    }
+}
+
+void ConvertFile(
+    const string &inputPath,
+    const string &outputPath,
+    const O2BConvertionOptions &baseOptions,
+    const variables_map &vm) {
+    O2BMappedFile file(inputPath);
+    ConvertSource(file.View(), inputPath, outputPath, baseOptions, vm);
+}
+
+// Collects (input, output) pairs from a directory tree or a list file
+vector<pair<string, string>> CollectBatchFiles(const string &inputPath, const variables_map &vm) {
+    vector<pair<string, string>> files;
+    string outputDir = vm.count("output-dir") ? vm["output-dir"].as<string>() : "";
+    auto outputPathOf = [&outputDir](const path &input, const path &relative) {
+        auto output = input;
+        if (!outputDir.empty()) {
+            output = path(outputDir) / relative;
         }
-        auto inputPath = vm["input-file"].as<string>();
-        auto len = inputPath.length();
-        if (len >= 4 && inputPath.substr(len - 4) == ".osu") {
-            fin.open(inputPath);
-            if (!fin) {
-                throw O2BException("Could not open file at " + inputPath);
+        // Archives expand into a directory named after them
+        output.replace_extension(HasExtension(input.string(), ".osz") ? "" : ".bms");
+        return output.string();
+    };
+    if (is_directory(inputPath)) {
+        auto root = path(inputPath).string();
+        for (auto &entry : recursive_directory_iterator(inputPath)) {
+            auto file = entry.path().string();
+            if (is_regular_file(entry.status()) && (HasExtension(file, ".osu") || HasExtension(file, ".osz"))) {
+                auto relative = file.substr(root.length());
+                while (!relative.empty() && (relative.front() == '/' || relative.front() == '\\')) {
+                    relative.erase(relative.begin());
+                }
+                files.emplace_back(file, outputPathOf(entry.path(), relative));
+            }
+        }
+        sort(files.begin(), files.end());
+    } else {
+        ifstream list(inputPath);
+        if (!list) {
+            throw O2BException("Could not open file at " + inputPath);
+        }
+        string line;
+        while (getline(list, line)) {
+            while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) {
+                line.pop_back();
             }
-            outputPath = inputPath.substr(0, len - 4) + ".bms";
+            if (line.empty()) {
+                continue;
+            }
+            if (!HasExtension(line, ".osu") && !HasExtension(line, ".osz")) {
+                throw O2BException("Input file type must be .osu or .osz: " + line);
+            }
+            files.emplace_back(line, outputPathOf(line, path(line).filename()));
+        }
+    }
+    return files;
+}
+
+// Resolves . and .. in a path with / or \\ separators, keeping a leading /.
+// Returns an empty string if the path climbs above where it starts.
+string NormalizedPath(const string &value) {
+    vector<string> parts;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        auto end = value.find_first_of("/\\", begin);
+        if (end == string::npos) {
+            end = value.size();
+        }
+        auto part = value.substr(begin, end - begin);
+        if (part == "..") {
+            if (parts.empty()) {
+                return "";
+            }
+            parts.pop_back();
+        } else if (!part.empty() && part != ".") {
+            parts.push_back(move(part));
+        }
+        begin = end + 1;
+    }
+    string result = !value.empty() && (value.front() == '/' || value.front() == '\\') ? "/" : "";
+    for (size_t i = 0; i < parts.size(); ++i) {
+        result += (i > 0 ? "/" : "") + parts[i];
+    }
+    return result;
+}
+
+// osu! runs on case-insensitive file systems, so charts often refer to files
+// with a case other than their names in the archive
+string FoldedCase(string value) {
+    transform(value.begin(), value.end(), value.begin(), [](unsigned char c) {
+        return static_cast<char>(tolower(c));
+    });
+    return value;
+}
+
+// Charts are laid out in a pack as they would be on disk, relative to root
+string PackEntryName(const string &outputPath, const string &root) {
+    auto name = NormalizedPath(absolute(path(outputPath)).generic_string());
+    if (name.size() <= root.size() + 1 || name.compare(0, root.size(), root) != 0 || name[root.size()] != '/') {
+        throw O2BException(outputPath + " is outside of " + root + ", use --output-dir to place it in the pack");
+    }
+    return name.substr(root.size() + 1);
+}
+
+// The files a converted chart refers to: its #WAV and #BMP definitions and its #STAGEFILE
+vector<string> ReferencedFiles(const O2BChart &chart, const O2BConvertionOptions &options) {
+    O2BResourceIndex index;
+    index.Add(chart, options);
+    vector<string> files;
+    for (const auto *table : { &index.Wavs(), &index.Bmps() }) {
+        for (size_t id = 1; id <= table->Size(); ++id) {
+            if (!table->Value(id).empty()) {
+                files.push_back(table->Value(id));
+            }
+        }
+    }
+    for (const auto &event : chart.Events) {
+        if (event.Type == O2BChart::EventType::Background) {
+            files.emplace_back(event.FilePath);
+            break;
+        }
+    }
+    return files;
+}
+
+string Failure(const char *type, const string &description) {
+    if (metrics) {
+        metrics->CountFailure(type);
+    }
+    return description;
+}
+
+// Returns the description of the error f throws, or an empty string.
+// Failures are counted by exception type for --metrics. Anything may be
+// thrown on a pipeline thread, and escaping it would end the whole batch.
+template <typename Function>
+string Attempt(Function &&f) {
+    try {
+        f();
+        return "";
+    } catch (const OsuException &e) {
+        return Failure("OsuException", e.Description());
+    } catch (const BmsException &e) {
+        return Failure("BmsException", e.Description());
+    } catch (const O2BException &e) {
+        return Failure("O2BException", e.Description());
+    } catch (const filesystem_error &e) {
+        return Failure("filesystem_error", e.what());
+    } catch (const exception &e) {
+        return Failure("exception", e.what());
+    }
+}
+
+// One chart on its way through the batch pipeline
+struct BatchDocument {
+    string InputPath; // archive/entry for archive members
+    string OutputPath;
+    string Inflated; // Archive members only
+    string_view Source;
+    string CacheKey;
+    O2BChart Chart;
+    string Text;
+    string SourceDirectory; // Where referenced files are looked up, within the archive for archive members
+    vector<string> ReferencedFiles; // With --pack
+    vector<string> MissingFiles; // Referenced files which could not be packed
+    O2BConvertionReport Report;
+    double ParseMilliseconds = 0;
+    double TotalMilliseconds = 0;
+    size_t InputBytes = 0;
+    size_t OutputBytes = 0;
+    bool UpToDate = false;
+    string Error;
+};
+
+// One input file: a single .osu file, or an .osz archive with one document per difficulty
+struct BatchItem {
+    size_t Index; // Position in the batch, which results are reported in
+    string InputPath;
+    string OutputPath; // A directory for archives
+    unique_ptr<O2BMappedFile> File;
+    vector<BatchDocument> Documents;
+    unique_ptr<O2BZipArchive> Archive; // Kept open for --pack
+    unordered_map<string, size_t> ArchiveEntries; // Entry index by name, with --pack
+    unordered_map<string, size_t> FoldedArchiveEntries; // Entry index by lowercase name, with --pack
+    O2BResourceIndex Resources; // Built from every document of an archive with --set
+    bool Shared = false;
+    string Error;
+};
+
+using BatchQueue = _Detail::BoundedQueue<unique_ptr<BatchItem>>;
+
+// Starts workerCount threads which pass items from input through process to
+// output, and closes output once the last of them runs out of input.
+// Items which failed earlier are passed on untouched.
+template <typename Function>
+void StartStage(
+    vector<thread> &threads, const char *stage, size_t workerCount,
+    BatchQueue &input, BatchQueue &output, Function process) {
+    auto remaining = make_shared<atomic<size_t>>(workerCount);
+    for (size_t i = 0; i < workerCount; ++i) {
+        threads.emplace_back([stage, &input, &output, process, remaining] {
+            unique_ptr<BatchItem> item;
+            while (input.Pop(item)) {
+                if (item->Error.empty()) {
+                    _Detail::Stopwatch stopwatch;
+                    item->Error = Attempt([&] {
+                        process(*item);
+                    });
+                    if (metrics) {
+                        metrics->ObserveStage(stage, stopwatch.Lap());
+                    }
+                }
+                output.Push(move(item));
+            }
+            if (--*remaining == 0) {
+                output.Close();
+            }
+        });
+    }
+}
+
+// A failing difficulty does not keep the rest of its archive from converting
+template <typename Function>
+void ForEachDocument(BatchItem &item, Function process) {
+    for (auto &document : item.Documents) {
+        if (document.Error.empty() && !document.UpToDate) {
+            document.Error = Attempt([&] {
+                process(document);
+            });
+        }
+    }
+}
+
+size_t StageWorkers(const variables_map &vm, const char *option, size_t defaultCount) {
+    auto count = vm[option].as<int>();
+    if (count < 0) {
+        throw O2BException(string("--") + option + " must not be negative");
+    }
+    return count > 0 ? static_cast<size_t>(count) : defaultCount;
+}
+
+// Marks document up to date if the cache holds its output for parameters
+bool FetchCached(BatchDocument &document, const string &parameters) {
+    if (!cache) {
+        return false;
+    }
+    document.CacheKey = O2BCache::Key(document.Source, parameters);
+    // Fetch copies the entry into place, which needs the directory to exist
+    auto parent = path(document.OutputPath).parent_path();
+    if (!parent.empty()) {
+        create_directories(parent);
+    }
+    document.UpToDate = cache->Fetch(document.CacheKey, document.OutputPath);
+    return document.UpToDate;
+}
+
+// Adds a converted chart and the files it refers to, looked up next to it or
+// in its archive. A file referred to by several charts is added once.
+void PackDocument(O2BZipWriter &pack, const string &root, BatchItem &item, BatchDocument &document) {
+    auto name = PackEntryName(document.OutputPath, root);
+    if (!pack.Claim(name)) {
+        throw O2BException(name + " is already in the pack");
+    }
+    pack.Add(name, document.Text);
+    document.Text = string();
+    auto directory = path(name).parent_path().generic_string();
+    for (const auto &file : document.ReferencedFiles) {
+        auto relative = NormalizedPath(file);
+        if (relative.empty() || relative.front() == '/' || relative.find(':') != string::npos) {
+            document.MissingFiles.push_back(file);
+            continue;
+        }
+        auto entryName = directory.empty() ? relative : directory + "/" + relative;
+        if (!pack.Claim(entryName)) {
+            continue;
+        }
+        auto source = document.SourceDirectory.empty() ? relative : document.SourceDirectory + "/" + relative;
+        if (item.Archive) {
+            auto it = item.ArchiveEntries.find(source);
+            if (it == item.ArchiveEntries.end()) {
+                it = item.FoldedArchiveEntries.find(FoldedCase(source));
+                if (it == item.FoldedArchiveEntries.end()) {
+                    document.MissingFiles.push_back(file);
+                    continue;
+                }
+            }
+            pack.AddEntry(entryName, *item.Archive, item.Archive->Entries()[it->second]);
+        } else if (is_regular_file(source)) {
+            pack.AddFile(entryName, source);
         } else {
-            throw O2BException("Input file type must be .osu");
+            document.MissingFiles.push_back(file);
         }
-        if (vm.count("output-file")) {
-            outputPath = vm["output-file"].as<string>();
+    }
+    document.ReferencedFiles = vector<string>();
+}
+
+// Converts (input, output) pairs, where the output of an .osz archive is a directory.
+// Reading, parsing, converting and writing run as concurrent stages joined by
+// bounded queues, so the disk and the cores are busy at the same time.
+// Results are reported in input order whatever order the files finish in.
+// With --pack, the output and the files it refers to go into one zip archive
+// in the same pass, named as they would be under --output-dir or the working
+// directory.
+// Returns the number of files which failed.
+size_t RunPipeline(const vector<pair<string, string>> &files, const variables_map &vm) {
+    auto options = MakeOptions(vm);
+    auto parameters = CacheParameters(options, vm);
+    bool sets = vm.count("set") != 0;
+    auto cores = static_cast<size_t>(max(1u, thread::hardware_concurrency()));
+    auto jobs = StageWorkers(vm, "jobs", cores);
+    auto readers = StageWorkers(vm, "read-jobs", 1);
+    auto parsers = StageWorkers(vm, "parse-jobs", jobs);
+    auto converters = StageWorkers(vm, "convert-jobs", jobs);
+    auto writers = StageWorkers(vm, "write-jobs", 1);
+    bool quiet = vm.count("quiet") != 0;
+    unique_ptr<O2BZipWriter> pack;
+    string packRoot;
+    if (vm.count("pack")) {
+        pack = make_unique<O2BZipWriter>(vm["pack"].as<string>());
+        packRoot = NormalizedPath(absolute(vm.count("output-dir")
+            ? path(vm["output-dir"].as<string>()) : current_path()).generic_string());
+    }
+    // Each queue holds enough items to keep the stage after it busy
+    BatchQueue readQueue(2 * readers);
+    BatchQueue parseQueue(2 * parsers);
+    BatchQueue convertQueue(2 * converters);
+    BatchQueue writeQueue(2 * writers);
+    BatchQueue doneQueue(2 * writers);
+    vector<thread> threads;
+    threads.emplace_back([&] {
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto item = make_unique<BatchItem>();
+            item->Index = i;
+            item->InputPath = files[i].first;
+            item->OutputPath = files[i].second;
+            readQueue.Push(move(item));
         }
-        len = outputPath.length();
-        if (len >= 4 && outputPath.substr(len - 4) == ".bms") {
-            fout.open(outputPath);
+        readQueue.Close();
+    });
+    // Archives are inflated here, so later stages see plain .osu text
+    StartStage(threads, "read", readers, readQueue, parseQueue, [&](BatchItem &item) {
+        if (!HasExtension(item.InputPath, ".osz")) {
+            item.File = make_unique<O2BMappedFile>(item.InputPath);
+            // The disk is read here rather than when the parser first touches each page
+            item.File->Prefetch();
+            item.Documents.emplace_back();
+            auto &document = item.Documents.back();
+            document.InputPath = item.InputPath;
+            document.OutputPath = item.OutputPath;
+            document.Source = item.File->View();
+            document.SourceDirectory = path(item.InputPath).parent_path().string();
+            return;
+        }
+        item.Archive = make_unique<O2BZipArchive>(item.InputPath);
+        auto &archive = *item.Archive;
+        item.Shared = sets;
+        const auto &entries = archive.Entries();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto &entry = entries[i];
+            if (pack) {
+                auto name = NormalizedPath(entry.Name);
+                item.FoldedArchiveEntries.emplace(FoldedCase(name), i);
+                item.ArchiveEntries.emplace(move(name), i);
+            }
+            if (!HasExtension(entry.Name, ".osu")) {
+                continue;
+            }
+            item.Documents.emplace_back();
+            auto &document = item.Documents.back();
+            document.InputPath = item.InputPath + "/" + entry.Name;
+            document.SourceDirectory = NormalizedPath(path(entry.Name).parent_path().generic_string());
+            auto outputPath = path(item.OutputPath) / path(entry.Name).filename();
+            document.OutputPath = outputPath.replace_extension(".bms").string();
+            document.Error = Attempt([&] {
+                document.Inflated = archive.Read(entry);
+            });
+        }
+        // Taken once the vector has stopped moving its strings around
+        for (auto &document : item.Documents) {
+            document.Source = document.Inflated;
+        }
+    });
+    // A set's output depends on every difficulty in it, so its cache lookups
+    // wait until all of them are parsed
+    StartStage(threads, "parse", parsers, parseQueue, convertQueue, [&](BatchItem &item) {
+        ForEachDocument(item, [&](BatchDocument &document) {
+            if (!item.Shared && FetchCached(document, parameters)) {
+                return;
+            }
+            _Detail::Stopwatch stopwatch;
+            O2BChartParser parse;
+            parse(document.Source, document.Chart);
+            document.ParseMilliseconds = stopwatch.Lap();
+        });
+        if (!item.Shared) {
+            return;
+        }
+        for (const auto &document : item.Documents) {
+            if (document.Error.empty()) {
+                item.Resources.Add(document.Chart, options);
+            }
+        }
+        item.Resources.Finalize();
+        auto setParameters = parameters + ";set=" + to_string(item.Resources.Fingerprint());
+        ForEachDocument(item, [&](BatchDocument &document) {
+            FetchCached(document, setParameters);
+        });
+    });
+    StartStage(threads, "convert", converters, convertQueue, writeQueue, [&](BatchItem &item) {
+        ForEachDocument(item, [&](BatchDocument &document) {
+            _Detail::Stopwatch stopwatch;
+            const auto &convert = ConverterFor(options, vm, document.Chart.KeyCount);
+            ostringstream out;
+            if (item.Shared) {
+                convert(document.Chart, item.Resources, out, &document.Report);
+            } else {
+                convert(document.Chart, out, &document.Report);
+            }
+            document.Text = out.str();
+            document.TotalMilliseconds = document.ParseMilliseconds + stopwatch.Lap();
+            document.InputBytes = document.Source.size();
+            document.OutputBytes = document.Text.size();
+            if (metrics) {
+                metrics->ObserveConverterStages(document.Report.Stages);
+            }
+            if (pack) {
+                document.ReferencedFiles = ReferencedFiles(document.Chart, options);
+            }
+            document.Chart.Clear();
+        });
+        // Nothing refers to the sources any more
+        for (auto &document : item.Documents) {
+            document.Inflated = string();
+            document.Source = string_view();
+        }
+        item.File.reset();
+        if (!pack) {
+            item.Archive.reset();
+        }
+    });
+    StartStage(threads, "write", writers, writeQueue, doneQueue, [&](BatchItem &item) {
+        ForEachDocument(item, [&](BatchDocument &document) {
+            if (pack) {
+                PackDocument(*pack, packRoot, item, document);
+                return;
+            }
+            auto parent = path(document.OutputPath).parent_path();
+            if (!parent.empty()) {
+                create_directories(parent);
+            }
+            ofstream fout(document.OutputPath);
             if (!fout) {
-                throw O2BException("Could not open file at " + outputPath);
+                throw O2BException("Could not open file at " + document.OutputPath);
             }
-        } else {
-            throw O2BException("Output file type must be .bms");
-        }
-        OsuBeatmap osuBeatmap;
-        fin >> osuBeatmap;
-        O2BConvertionOptions options;
-        auto keyCount = osuBeatmap.ManiaKeyCount();
-        if (vm.count("key-map")) {
-            auto &channels = vm["key-map"].as<vector<int>>();
-            for (auto channel : channels) {
-                if (channel < 11 || channel > 19) {
-                    throw O2BException("Key channels should be in range [11, 19]");
+            fout << document.Text;
+            fout.close();
+            if (!fout) {
+                throw O2BException("Could not write file at " + document.OutputPath);
+            }
+            document.Text = string();
+            if (cache) {
+                cache->Store(document.CacheKey, document.OutputPath);
+            }
+        });
+        item.Archive.reset();
+    });
+    // Items finish out of order; each is held until those before it are reported
+    size_t failed = 0;
+    size_t next = 0;
+    map<size_t, unique_ptr<BatchItem>> pending;
+    unique_ptr<BatchItem> item;
+    while (doneQueue.Pop(item)) {
+        auto index = item->Index;
+        pending.emplace(index, move(item));
+        for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+            const auto &done = *it->second;
+            bool succeeded = done.Error.empty();
+            if (!succeeded) {
+                cerr << "osu2bms: [Error] " << done.InputPath << ": " << done.Error << endl;
+            }
+            for (const auto &document : done.Documents) {
+                if (!document.Error.empty()) {
+                    succeeded = false;
+                    cerr << "osu2bms: [Error] " << document.InputPath << ": " << document.Error << endl;
+                } else if (document.UpToDate) {
+                    if (metrics) {
+                        metrics->CountCachedChart();
+                    }
+                    if (!quiet) {
+                        cout << document.OutputPath << ": up to date\n";
+                    }
+                } else {
+                    if (metrics) {
+                        metrics->CountChart(document.InputBytes, document.OutputBytes);
+                    }
+                    if (!quiet) {
+                        for (const auto &file : document.MissingFiles) {
+                            cerr << "osu2bms: [Warning] " << document.InputPath << ": " << file << " is missing and was left out of the pack" << endl;
+                        }
+                    }
+                    if (vm.count("profile")) {
+                        lock_guard<mutex> lock(profileMutex);
+                        profileEntries.push_back({ document.InputPath, document.OutputPath,
+                            document.ParseMilliseconds, document.TotalMilliseconds, document.Report });
+                    }
+                    if (!quiet) {
+                        cout << ReportLine(document.OutputPath, document.Report);
+                    }
                 }
-                options.KeyMap.push_back(static_cast<BmsChannelId>(channel));
             }
+            if (!succeeded) {
+                ++failed;
+            }
+            pending.erase(it);
         }
-        if (vm.count("key-map-o2mania")) {
-            if (!options.KeyMap.empty()) {
-                throw O2BException("Key maps are in conflict.");
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (pack) {
+        pack->Close();
+    }
+    return failed;
+}
+
+int RunBatch(const string &inputPath, const variables_map &vm) {
+    auto files = CollectBatchFiles(inputPath, vm);
+    auto failed = RunPipeline(files, vm);
+    if (!vm.count("quiet")) {
+        cout << "Converted " << files.size() - failed << " of " << files.size() << " files" << endl;
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+string JsonString(const string &value) {
+    string result = "\"";
+    for (auto c : value) {
+        switch (c) {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                result += escaped;
+            } else {
+                result += c;
             }
-            options.KeyMap = GetBmsChannels(keyCount, false, true, true);
+            break;
         }
-        if (vm.count("key-map-default")) {
-            if (!options.KeyMap.empty()) {
-                throw O2BException("Key maps are in conflict.");
+    }
+    return result + "\"";
+}
+
+void WriteStage(ostream &out, const char *name, const O2BConvertionReport::Stage &stage, bool last = false) {
+    out << "        " << JsonString(name) << ": { \"milliseconds\": " << stage.Milliseconds
+        << ", \"allocations\": " << stage.Allocations << (last ? " }\n" : " },\n");
+}
+
+// Writes the collected profile entries, slowest conversion first
+void WriteProfile(const string &profilePath) {
+    ofstream out(profilePath);
+    if (!out) {
+        throw O2BException("Could not open file at " + profilePath);
+    }
+    sort(profileEntries.begin(), profileEntries.end(), [](const ProfileEntry &lhs, const ProfileEntry &rhs) {
+        return lhs.TotalMilliseconds > rhs.TotalMilliseconds;
+    });
+    out << "[\n";
+    for (size_t i = 0; i < profileEntries.size(); ++i) {
+        const auto &entry = profileEntries[i];
+        const auto &report = entry.Report;
+        out << "  {\n"
+            << "    \"input\": " << JsonString(entry.InputPath) << ",\n"
+            << "    \"output\": " << JsonString(entry.OutputPath) << ",\n"
+            << "    \"totalMilliseconds\": " << entry.TotalMilliseconds << ",\n"
+            << "    \"parseMilliseconds\": " << entry.ParseMilliseconds << ",\n"
+            << "    \"notes\": " << report.NoteCount << ",\n"
+            << "    \"bpms\": " << report.BpmCount << ",\n"
+            << "    \"rawBpms\": " << report.RawBpmCount << ",\n"
+            << "    \"bpmChanges\": " << report.BpmChangeCount << ",\n"
+            << "    \"rawBpmChanges\": " << report.RawBpmChangeCount << ",\n"
+            << "    \"wavs\": " << report.WavCount << ",\n"
+            << "    \"bmps\": " << report.BmpCount << ",\n"
+            << "    \"sections\": " << report.SectionCount << ",\n"
+            << "    \"wavIds\": " << report.WavIdCount << ",\n"
+            << "    \"wavRedefinitions\": " << report.WavRedefinitionCount << ",\n"
+            << "    \"maxTimingError\": " << report.MaxTimingError << ",\n"
+            << "    \"meanTimingError\": " << report.MeanTimingError << ",\n"
+            << "    \"offGridNotes\": " << report.OffGridNoteCount << ",\n"
+            << "    \"stages\": {\n";
+        WriteStage(out, "GenerateNotes", report.Stages.GenerateNotes);
+        WriteStage(out, "SortNotes", report.Stages.SortNotes);
+        WriteStage(out, "ConvertTimeToPosition", report.Stages.ConvertTimeToPosition);
+        WriteStage(out, "QuantizePositions", report.Stages.QuantizePositions);
+        WriteStage(out, "GenerateBeatmap", report.Stages.GenerateBeatmap, true);
+        out << "    }\n"
+            << (i + 1 < profileEntries.size() ? "  },\n" : "  }\n");
+    }
+    out << "]" << endl;
+}
+
+// Output of a single .osu file, next to it unless <output-file> is given
+string OutputPathOf(const string &inputPath, const variables_map &vm) {
+    string outputPath = inputPath.substr(0, inputPath.length() - 4) + ".bms";
+    if (vm.count("output-file")) {
+        outputPath = vm["output-file"].as<string>();
+    }
+    if (!HasExtension(outputPath, ".bms")) {
+        throw O2BException("Output file type must be .bms");
+    }
+    return outputPath;
+}
+
+// Converts each .osu file under root as soon as it is saved, next to it or
+// under --output-dir. Files saved without changes are skipped.
+// Runs until interrupted.
+int RunWatch(const string &root, const variables_map &vm) {
+    auto options = MakeOptions(vm);
+    auto debounce = vm["debounce"].as<int>();
+    if (debounce < 0) {
+        throw O2BException("Debounce time must not be negative");
+    }
+    string outputDir = vm.count("output-dir") ? vm["output-dir"].as<string>() : "";
+    O2BDirectoryWatcher watcher(root);
+    if (!vm.count("quiet")) {
+        cout << "Watching " << root << endl;
+    }
+    unordered_map<string, uint64_t> lastHashes;
+    for (;;) {
+        for (const auto &file : watcher.WaitForChanges(chrono::milliseconds(debounce))) {
+            if (!HasExtension(file, ".osu")) {
+                continue;
+            }
+            auto description = Attempt([&] {
+                // Read rather than mapped: an editor may truncate the file
+                // while it is saved, which would fault on a mapping
+                ifstream fin(file, ios::binary);
+                if (!fin) {
+                    throw O2BException("Could not open file at " + file);
+                }
+                string source(istreambuf_iterator<char>(fin), {});
+                if (fin.bad()) {
+                    throw O2BException("Could not read file at " + file);
+                }
+                string_view view = source;
+                auto hash = _Detail::Hash64(view.data(), view.size());
+                auto last = lastHashes.find(file);
+                if (last != lastHashes.end() && last->second == hash) {
+                    return;
+                }
+                path output = file;
+                if (!outputDir.empty()) {
+                    auto relative = file.substr(root.length());
+                    relative.erase(0, relative.find_first_not_of('/'));
+                    output = path(outputDir) / relative;
+                    create_directories(output.parent_path());
+                }
+                output.replace_extension(".bms");
+                ConvertSource(view, file, output.string(), options, vm);
+                lastHashes[file] = hash;
+            });
+            if (!description.empty()) {
+                cerr << "osu2bms: [Error] " << file << ": " << description << endl;
+            }
+        }
+        if (cache) {
+            cache->Trim();
+        }
+    }
+}
+
+// Requests may differ in their options, so each worker keeps converters per
+// options and key count, dropping them all if clients keep asking for new ones
+const O2BConverter &RequestConverterFor(const O2BConvertionOptions &baseOptions, const variables_map &vm, uint8_t keyCount) {
+    static thread_local unordered_map<string, unique_ptr<O2BConverter>> converters;
+    auto key = O2BCache::SerializeOptions(baseOptions);
+    key += vm.count("key-map-o2mania") ? ";o2mania" : "";
+    key += ";keys=" + to_string(keyCount);
+    if (converters.size() >= 64 && !converters.count(key)) {
+        converters.clear();
+    }
+    auto &converter = converters[key];
+    if (!converter) {
+        auto options = baseOptions;
+        ApplyKeyMap(options, vm, keyCount);
+        converter = make_unique<O2BConverter>(options, sectionPool.get());
+    }
+    return *converter;
+}
+
+// Handles one request sent by RunClient.
+// Request: protocolVersion, working directory, chart (read when <input-file> is -), arguments...
+// Response: "ok", output path (empty for stdout), BMS text, message; or "error", description.
+// Relative paths are resolved against the client's working directory; the
+// client writes the output itself.
+// The server's handler must not throw, so every error becomes a response.
+void ServeRequest(const vector<string> &request, vector<string> &response) {
+    auto description = Attempt([&] {
+        if (request.size() < 3 || request[0] != protocolVersion) {
+            throw O2BException("Unsupported request, the client and the server may be different versions");
+        }
+        vector<const char *> argv = { "osu2bms" };
+        for (auto it = request.begin() + 3; it != request.end(); ++it) {
+            argv.push_back(it->c_str());
+        }
+        auto vm = ParseArguments(argv.size(), argv.data());
+        if (vm.count("help") || vm.count("version")) {
+            ostringstream ss;
+            if (vm.count("help")) {
+                ss << visibleOptions << '\n';
+            } else {
+                ss << "osu2bms version v0.0.1-alpha\n";
             }
+            response = { "ok", "", "", ss.str() };
+            return;
         }
-        if (options.KeyMap.empty()) {
-            options.KeyMap = GetBmsChannels(keyCount, false, true, false);
+        for (auto option : { "serve", "watch", "output-dir", "cache-dir", "profile", "pack", "metrics" }) {
+            if (vm.count(option)) {
+                throw O2BException(string("--") + option + " cannot be used together with --connect");
+            }
+        }
+        if (!vm.count("input-file")) {
+            throw O2BException("No input file");
+        }
+        auto inputPath = vm["input-file"].as<string>();
+        auto baseOptions = MakeOptions(vm);
+        string outputPath;
+        size_t inputBytes = 0;
+        // Reused by every request this worker handles
+        static thread_local O2BChart chart;
+        O2BChartParser parse;
+        // The chart refers into the file, so it stays mapped until the conversion is done
+        unique_ptr<O2BMappedFile> file;
+        if (inputPath == "-") {
+            if (vm.count("output-file") && vm["output-file"].as<string>() != "-") {
+                outputPath = vm["output-file"].as<string>();
+                if (!HasExtension(outputPath, ".bms")) {
+                    throw O2BException("Output file type must be .bms");
+                }
+            }
+            parse(request[2], chart);
+            inputBytes = request[2].size();
+        } else {
+            if (!HasExtension(inputPath, ".osu")) {
+                throw O2BException("Only single .osu files can be converted through --connect");
+            }
+            outputPath = OutputPathOf(inputPath, vm);
+            path input = inputPath;
+            if (!input.is_absolute()) {
+                input = path(request[1]) / input;
+            }
+            file = make_unique<O2BMappedFile>(input.string());
+            parse(file->View(), chart);
+            inputBytes = file->View().size();
+        }
+        const auto &convert = RequestConverterFor(baseOptions, vm, chart.KeyCount);
+        ostringstream out;
+        O2BConvertionReport report;
+        convert(chart, out, &report);
+        auto text = out.str();
+        if (metrics) {
+            metrics->ObserveConverterStages(report.Stages);
+            metrics->CountChart(inputBytes, text.size());
+        }
+        auto message = vm.count("quiet") ? "" : ReportLine(outputPath.empty() ? "<stdout>" : outputPath, report);
+        response = { "ok", outputPath, move(text), message };
+    });
+    if (!description.empty() || response.empty()) {
+        response = { "error", description };
+    }
+}
+
+// Runs until interrupted
+int RunServer(const string &socketPath, const variables_map &vm) {
+    auto jobs = vm["jobs"].as<int>();
+    if (jobs < 0) {
+        throw O2BException("Number of jobs must not be negative");
+    }
+    auto queueSize = vm["queue-size"].as<int>();
+    if (queueSize <= 0) {
+        throw O2BException("Queue size must be greater than 0");
+    }
+    O2BServer server(socketPath, static_cast<size_t>(jobs), static_cast<size_t>(queueSize), ServeRequest);
+    if (!vm.count("quiet")) {
+        cout << "Listening on " << socketPath << " with " << server.WorkerCount() << " workers" << endl;
+    }
+    server.Run();
+    return EXIT_SUCCESS;
+}
+
+// Whether <input-file>, the first positional argument, is -. Only the
+// options of InitializeOptions which take no value are listed; any other
+// option is taken to be followed by its value, and --key-map by all of its
+// values. The server parses the arguments properly.
+bool ReadsStandardInput(const vector<string> &arguments) {
+    static const unordered_set<string> flags = {
+        "help", "version", "quiet", "key-map-default", "key-map-o2mania", "no-bga", "no-event-sounds",
+        "no-inherited-timing-points", "no-key-sounds", "no-timing-points", "reuse-wav-ids", "set"
+    };
+    bool multitoken = false;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if (argument == "--") {
+            return i + 1 < arguments.size() && arguments[i + 1] == "-";
         }
-        auto gridSize = vm["max-grid-size"].as<int>();
-        if (gridSize <= 0 || gridSize >= 256) {
-            throw O2BException("Maximum grid partition size should be in range [1, 255]");
+        if (argument.size() < 2 || argument[0] != '-') {
+            // Like boost, --key-map takes every value up to the next option, even -
+            if (!multitoken) {
+                return argument == "-";
+            }
+            continue;
         }
-        options.GridSize = static_cast<uint8_t>(gridSize);
-        options.WithBga = vm.count("no-bga") == 0;
-        options.WithEventSounds = vm.count("no-event-sounds") == 0;
-        options.WithInheritedTimingPoints = vm.count("no-inherited-timing-points") == 0;
-        options.WithKeySounds = vm.count("no-key-sounds") == 0;
-        options.WithTimingPoints = vm.count("no-timing-points") == 0;
-        if (!options.WithTimingPoints) {
-            if (!vm.count("bpm")) {
-                throw O2BException("BPM must be provided if --no-timing-points is set");
+        multitoken = false;
+        if (argument[1] == '-') {
+            auto name = argument.substr(2);
+            if (name.find('=') == string::npos && !flags.count(name)) {
+                multitoken = name == "key-map";
+                i += multitoken ? 0 : 1;
             }
-            options.CustomBpm = vm["bpm"].as<double>();
-            if (options.CustomBpm <= 0) {
-                throw O2BException("BPM value must be greater than 0");
+        } else if (argument.size() == 2 && argument[1] != 'v' && argument[1] != 'q') {
+            multitoken = argument[1] == 'm';
+            i += multitoken ? 0 : 1;
+        }
+    }
+    return false;
+}
+
+// Forwards the arguments to a --serve server and writes what it returns.
+// Nothing is parsed here, so a conversion only costs the round trip.
+int RunClient(const string &socketPath, const vector<string> &arguments) {
+    try {
+        string chart;
+        if (ReadsStandardInput(arguments)) {
+            chart.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+        }
+        auto workingDirectory = current_path().string();
+        vector<string_view> request = { protocolVersion, workingDirectory, chart };
+        request.insert(request.end(), arguments.begin(), arguments.end());
+        auto connection = O2BSocket::Connect(socketPath);
+        connection.Send(request);
+        vector<string> response;
+        if (!connection.Receive(response) || response.empty()) {
+            throw O2BException("The server closed the connection");
+        }
+        if (response[0] != "ok" || response.size() < 4) {
+            throw O2BException(response.size() > 1 ? response[1] : "Malformed response from the server");
+        }
+        const auto &outputPath = response[1];
+        const auto &text = response[2];
+        const auto &message = response[3];
+        if (outputPath.empty()) {
+            cout << text << flush;
+            cerr << message;
+            return EXIT_SUCCESS;
+        }
+        ofstream fout(outputPath);
+        if (!fout) {
+            throw O2BException("Could not open file at " + outputPath);
+        }
+        fout << text;
+        fout.close();
+        if (!fout) {
+            throw O2BException("Could not write file at " + outputPath);
+        }
+        cout << message;
+        return EXIT_SUCCESS;
+    } catch (const O2BException &e) {
+        cerr << "osu2bms: [Error] " << e.Description() << endl;
+    } catch (const filesystem_error &e) {
+        cerr << "osu2bms: [Error] " << e.what() << endl;
+    } catch (const exception &e) {
+        cerr << "osu2bms: [Error] " << e.what() << endl;
+    }
+    return EXIT_FAILURE;
+}
+
+int Run(const variables_map &vm) {
+    if (vm.count("pack")) {
+        if (vm.count("serve") || vm.count("watch")) {
+            throw O2BException("--pack cannot be used together with --serve or --watch");
+        }
+        if (vm.count("cache-dir")) {
+            throw O2BException("--pack cannot be used together with --cache-dir");
+        }
+    }
+    if (vm.count("serve")) {
+        if (vm.count("input-file")) {
+            throw O2BException("<input-file> cannot be used together with --serve");
+        }
+        sectionPool = make_unique<O2BThreadPool>();
+        return RunServer(vm["serve"].as<string>(), vm);
+    }
+    if (vm.count("watch")) {
+        if (vm.count("input-file")) {
+            throw O2BException("<input-file> cannot be used together with --watch");
+        }
+        sectionPool = make_unique<O2BThreadPool>();
+        return RunWatch(vm["watch"].as<string>(), vm);
+    }
+    if (!vm.count("input-file")) {
+        throw O2BException("No input file");
+    }
+    auto inputPath = vm["input-file"].as<string>();
+    if (is_directory(inputPath) || HasExtension(inputPath, ".txt")) {
+        if (vm.count("output-file")) {
+            throw O2BException("Use --output-dir instead of <output-file> in batch mode");
+        }
+        return RunBatch(inputPath, vm);
+    }
+    if (HasExtension(inputPath, ".osz")) {
+        if (vm.count("output-file")) {
+            throw O2BException("Use --output-dir instead of <output-file> for .osz archives");
+        }
+        auto outputDir = vm.count("output-dir")
+            ? vm["output-dir"].as<string>()
+            : inputPath.substr(0, inputPath.length() - 4);
+        return RunPipeline({ { inputPath, outputDir } }, vm) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!HasExtension(inputPath, ".osu")) {
+        throw O2BException("Input file type must be .osu or .osz");
+    }
+    if (vm.count("pack")) {
+        return RunPipeline({ { inputPath, OutputPathOf(inputPath, vm) } }, vm) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    sectionPool = make_unique<O2BThreadPool>();
+    ConvertFile(inputPath, OutputPathOf(inputPath, vm), MakeOptions(vm), vm);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char *argv[]) {
+    // Looked for before anything else, so that the client does no more work than it must
+    string socketPath;
+    vector<string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        string_view argument = argv[i];
+        if (argument == "--connect" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (argument.substr(0, 10) == "--connect=") {
+            socketPath = string(argument.substr(10));
+        } else {
+            arguments.emplace_back(argument);
+        }
+    }
+    if (!socketPath.empty()) {
+        return RunClient(socketPath, arguments);
+    }
+    variables_map vm;
+    int status = EXIT_FAILURE;
+    unique_ptr<O2BMetricsExporter> exporter;
+    try {
+        InitializeOptions();
+        vm = ParseArguments(argc, argv);
+        if (vm.count("help")) {
+            cout << visibleOptions << endl;
+            return EXIT_SUCCESS;
+        }
+        if (vm.count("version")) {
+            cout << "osu2bms version v0.0.1-alpha" << endl;
+            return EXIT_SUCCESS;
+        }
+        if (vm.count("cache-dir")) {
+            auto cacheSize = vm["cache-size"].as<int>();
+            if (cacheSize <= 0) {
+                throw O2BException("Cache size must be greater than 0");
             }
-            auto meter = vm["meter"].as<int>();
-            if (meter <= 0) {
-                throw O2BException("Meter value must be greater than 0");
+            cache = make_unique<O2BCache>(vm["cache-dir"].as<string>(), static_cast<uintmax_t>(cacheSize) << 20);
+        }
+        if (vm.count("metrics")) {
+            auto interval = vm["metrics-interval"].as<int>();
+            if (interval <= 0) {
+                throw O2BException("Metrics interval must be greater than 0");
             }
-            options.CustomMeter = static_cast<uint8_t>(meter);
+            metrics = make_unique<O2BMetrics>();
+            exporter = make_unique<O2BMetricsExporter>(*metrics, vm["metrics"].as<string>(), chrono::seconds(interval));
         }
-        options.Offset = vm["offset"].as<double>();
-        O2BConverter convert(options);
-        auto bmsBeatmap = convert(osuBeatmap);
-        fout << bmsBeatmap.StringValue() << endl;
+        status = Run(vm);
     } catch (const OsuException &e) {
         cerr << "osu2bms: [Error] " << e.Description() << endl;
-        return EXIT_FAILURE;
     } catch (const BmsException &e) {
         cerr << "osu2bms: [Error] " << e.Description() << endl;
-        return EXIT_FAILURE;
     } catch (const O2BException &e) {
         cerr << "osu2bms: [Error] " << e.Description() << endl;
-        return EXIT_FAILURE;
+    } catch (const filesystem_error &e) {
+        cerr << "osu2bms: [Error] " << e.what() << endl;
+    } catch (const exception &e) {
+        cerr << "osu2bms: [Error] " << e.what() << endl;
     }
-    return EXIT_SUCCESS;
+    if (cache) {
+        cache->Trim();
+        if (!vm.count("quiet")) {
+            cout << "Cache: " << cache->Hits() << " hits, " << cache->Misses() << " misses, "
+                << cache->Evictions() << " evicted" << endl;
+        }
+    }
+    if (exporter) {
+        try {
+            exporter->Finish();
+        } catch (const O2BException &e) {
+            cerr << "osu2bms: [Error] " << e.Description() << endl;
+            status = EXIT_FAILURE;
+        }
+    }
+    // Written even if some conversions failed, covering the ones that succeeded
+    if (vm.count("profile")) {
+        try {
+            WriteProfile(vm["profile"].as<string>());
+        } catch (const O2BException &e) {
+            cerr << "osu2bms: [Error] " << e.Description() << endl;
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
 }
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "Bms.hpp"
+#include "Osu.hpp"
+#include "O2BConverter.hpp"
+#include "O2BConvertionReport.hpp"
+#include "O2BException.hpp"
+#include "_Detail/Stopwatch.hpp"
+
+using namespace std;
+using namespace boost::program_options;
+using namespace Bms;
+using namespace Osu;
+using namespace Osu2Bms;
+
+struct ChartParameters {
+    int KeyCount;
+    size_t ObjectCount;
+    double HoldRatio; // Fraction of hit objects which are holds
+    size_t KeySoundCount; // Distinct key sounds, 0 for none
+    double SvDensity; // Inherited timing points per hit object
+    size_t EventCount; // Storyboard sound effects
+    uint32_t Seed;
+};
+
+// Builds a chart at 4 objects per beat and 150 BPM, with a BPM change every
+// 64 beats, so every converter stage gets a realistic amount of work
+OsuBeatmap GenerateChart(const ChartParameters &parameters) {
+    mt19937 random(parameters.Seed);
+    uniform_real_distribution<double> unit(0, 1);
+    OsuBeatmap beatmap;
+    beatmap.AudioFilename = "audio.ogg";
+    beatmap.AudioLeadIn = 0;
+    beatmap.ArtistUnicode = "osu2bms";
+    beatmap.TitleUnicode = "Synthetic Benchmark";
+    beatmap.CircleSize = parameters.KeyCount;
+    const double beatLength = 400;
+    const double step = beatLength / 4;
+    const auto duration = static_cast<int32_t>(parameters.ObjectCount * step) + 1000;
+    const auto segmentLength = static_cast<int32_t>(beatLength * 64);
+    for (int32_t time = 0; time < duration; time += segmentLength) {
+        OsuTimingPoint tp;
+        tp.Time = time;
+        // Alternates between 150 and 200 BPM
+        tp.BeatLength = (time / segmentLength) % 2 == 0 ? beatLength : beatLength * 0.75;
+        tp.Meter = 4;
+        tp.Inherited = false;
+        beatmap.TimingPoints.push_back(tp);
+    }
+    auto svCount = static_cast<size_t>(parameters.SvDensity * parameters.ObjectCount);
+    for (size_t i = 0; i < svCount; ++i) {
+        OsuTimingPoint tp;
+        // Strictly after the first uninherited point
+        tp.Time = 1 + static_cast<int32_t>(unit(random) * (duration - 1));
+        tp.BeatLength = -100 / (0.5 + unit(random));
+        tp.Meter = 4;
+        tp.Inherited = true;
+        beatmap.TimingPoints.push_back(tp);
+    }
+    stable_sort(beatmap.TimingPoints.begin(), beatmap.TimingPoints.end(),
+        [](const OsuTimingPoint &lhs, const OsuTimingPoint &rhs) {
+        return lhs.Time < rhs.Time;
+    });
+    uniform_int_distribution<int> column(0, parameters.KeyCount - 1);
+    for (size_t i = 0; i < parameters.ObjectCount; ++i) {
+        auto time = static_cast<int32_t>(i * step);
+        shared_ptr<OsuHitObject> object;
+        if (unit(random) < parameters.HoldRatio) {
+            auto hold = make_shared<OsuHold>();
+            hold->EndTime = time + static_cast<int32_t>(step * (1 + random() % 8));
+            object = hold;
+        } else {
+            object = make_shared<OsuHitObject>();
+        }
+        object->StartTime = time;
+        object->StartPoint.X = (column(random) * 512 + 256) / parameters.KeyCount;
+        object->StartPoint.Y = 192;
+        if (parameters.KeySoundCount > 0) {
+            object->StartPoint.CustomHitSound = "key" + to_string(random() % parameters.KeySoundCount) + ".wav";
+        }
+        beatmap.HitObjects.push_back(object);
+    }
+    for (size_t i = 0; i < parameters.EventCount; ++i) {
+        auto event = make_shared<OsuSoundEffectEvent>();
+        event->Time = static_cast<int32_t>(unit(random) * duration);
+        event->FilePath = "sfx" + to_string(i % 64) + ".wav";
+        beatmap.Events.push_back(event);
+    }
+    return beatmap;
+}
+
+struct Samples {
+    string Name;
+    vector<double> Values;
+};
+
+void WriteSamples(ostream &out, const Samples &samples) {
+    auto sorted = samples.Values;
+    sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (auto value : sorted) {
+        sum += value;
+    }
+    out << "    \"" << samples.Name << "\": { "
+        << "\"min\": " << sorted.front() << ", "
+        << "\"median\": " << sorted[sorted.size() / 2] << ", "
+        << "\"mean\": " << sum / sorted.size() << ", "
+        << "\"max\": " << sorted.back() << " }";
+}
+
+int main(int argc, const char *argv[]) {
+    ChartParameters parameters;
+    int iterations;
+    options_description description("osu2bms benchmark");
+    description.add_options()
+        ("help,h", "show help message")
+        ("keys", value<int>(&parameters.KeyCount)->default_value(7), "key count, [1, 9]")
+        ("objects", value<size_t>(&parameters.ObjectCount)->default_value(10000), "hit object count")
+        ("hold-ratio", value<double>(&parameters.HoldRatio)->default_value(0.2), "fraction of hit objects which are holds, [0, 1]")
+        ("keysounds", value<size_t>(&parameters.KeySoundCount)->default_value(500), "distinct key sounds, 0 for none")
+        ("sv-density", value<double>(&parameters.SvDensity)->default_value(0.05), "inherited timing points per hit object")
+        ("events", value<size_t>(&parameters.EventCount)->default_value(200), "storyboard sound effect count")
+        ("seed", value<uint32_t>(&parameters.Seed)->default_value(1), "random seed")
+        ("iterations,n", value<int>(&iterations)->default_value(10), "timed runs per stage")
+        ("output,o", value<string>(), "file to write JSON results to, stdout if omitted");
+    variables_map vm;
+    try {
+        store(parse_command_line(argc, argv, description), vm);
+        notify(vm);
+    } catch (const error &e) {
+        cerr << "O2BBenchmark: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        cout << description << endl;
+        return EXIT_SUCCESS;
+    }
+    if (parameters.KeyCount < 1 || parameters.KeyCount > 9 || iterations < 1) {
+        cerr << "O2BBenchmark: Invalid parameters" << endl;
+        return EXIT_FAILURE;
+    }
+    auto beatmap = GenerateChart(parameters);
+    O2BConvertionOptions options;
+    options.KeyMap = GetBmsChannels(static_cast<uint8_t>(parameters.KeyCount), false, true, false);
+    O2BConverter convert(options);
+    vector<Samples> samples;
+    for (auto name : { "GenerateNotes", "SortNotes", "ConvertTimeToPosition", "QuantizePositions",
+        "GenerateBeatmap", "Serialize", "WriteStream", "EndToEnd" }) {
+        samples.push_back({ name, {} });
+    }
+    O2BConvertionReport report;
+    size_t outputSize = 0;
+    try {
+        for (int i = 0; i < iterations; ++i) {
+            _Detail::Stopwatch stopwatch;
+            auto bmsBeatmap = convert(beatmap, &report);
+            auto converted = stopwatch.Lap();
+            auto text = bmsBeatmap.StringValue();
+            auto serialized = stopwatch.Lap();
+            const auto &stages = report.Stages;
+            samples[0].Values.push_back(stages.GenerateNotes.Milliseconds);
+            samples[1].Values.push_back(stages.SortNotes.Milliseconds);
+            samples[2].Values.push_back(stages.ConvertTimeToPosition.Milliseconds);
+            samples[3].Values.push_back(stages.QuantizePositions.Milliseconds);
+            samples[4].Values.push_back(stages.GenerateBeatmap.Milliseconds);
+            samples[5].Values.push_back(serialized);
+            samples[7].Values.push_back(converted + serialized);
+            ostringstream out;
+            convert(beatmap, out, &report);
+            samples[6].Values.push_back(stopwatch.Lap());
+            outputSize = out.str().size();
+        }
+    } catch (const BmsException &e) {
+        cerr << "O2BBenchmark: " << e.Description() << endl;
+        return EXIT_FAILURE;
+    } catch (const O2BException &e) {
+        cerr << "O2BBenchmark: " << e.Description() << endl;
+        return EXIT_FAILURE;
+    }
+    ofstream file;
+    if (vm.count("output")) {
+        file.open(vm["output"].as<string>());
+        if (!file) {
+            cerr << "O2BBenchmark: Could not open file at " << vm["output"].as<string>() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    ostream &out = file.is_open() ? file : cout;
+    // Times are in milliseconds
+    out << "{\n"
+        << "  \"parameters\": { "
+        << "\"keys\": " << parameters.KeyCount << ", "
+        << "\"objects\": " << parameters.ObjectCount << ", "
+        << "\"holdRatio\": " << parameters.HoldRatio << ", "
+        << "\"keysounds\": " << parameters.KeySoundCount << ", "
+        << "\"svDensity\": " << parameters.SvDensity << ", "
+        << "\"events\": " << parameters.EventCount << ", "
+        << "\"seed\": " << parameters.Seed << ", "
+        << "\"iterations\": " << iterations << " },\n"
+        << "  \"notes\": " << report.NoteCount << ",\n"
+        << "  \"outputBytes\": " << outputSize << ",\n"
+        << "  \"stages\": {\n";
+    for (size_t i = 0; i < samples.size(); ++i) {
+        WriteSamples(out, samples[i]);
+        out << (i + 1 < samples.size() ? ",\n" : "\n");
+    }
+    out << "  }\n}" << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "O2BChart.hpp"
+#include "O2BChartParser.hpp"
+#include "O2BException.hpp"
+
+using namespace std;
+using namespace Osu2Bms;
+
+namespace {
+
+    size_t failureCount = 0;
+
+    void Check(bool condition, const string &what) {
+        if (!condition) {
+            cerr << "FAILED: " << what << endl;
+            ++failureCount;
+        }
+    }
+
+    // The description of the error parsing text raises, or an empty string
+    string ErrorOf(string_view text) {
+        try {
+            O2BChartParser()(text);
+        } catch (const O2BException &e) {
+            return e.Description();
+        }
+        return "";
+    }
+
+    const string chartText =
+        "\xEF\xBB\xBFosu file format v14\r\n"
+        "\r\n"
+        "[General]\r\n"
+        "AudioFilename: audio.mp3\r\n"
+        "AudioLeadIn: 500\r\n"
+        "Mode: 3\r\n"
+        "\r\n"
+        "[Metadata]\r\n"
+        "Title:Song\r\n"
+        "TitleUnicode:\xE6\x9B\xB2\r\n"
+        "ArtistUnicode:Artist\r\n"
+        "\r\n"
+        "[Difficulty]\r\n"
+        "CircleSize:4\r\n"
+        "\r\n"
+        "[Events]\r\n"
+        "//Background and Video events\r\n"
+        "0,0,\"bg.jpg\",0,0\r\n"
+        "Video,120,\"video.mp4\"\r\n"
+        "//Storyboard Sound Samples\r\n"
+        "Sample,1000,0,\"clap.wav\",70\r\n"
+        "Sprite,Foreground,Centre,\"sb.png\",320,240\r\n"
+        " F,0,0,1000,0,1\r\n"
+        "\r\n"
+        "[TimingPoints]\r\n"
+        "0,500,4,1,0,100,1,0\r\n"
+        "1000,-50,4,1,0,100,0,0\r\n"
+        "2000,400,3,1,0,100,1,0\r\n"
+        "2500,400,0,1,0,100,1,0\r\n"
+        "3000,-200\r\n"
+        "\r\n"
+        "[HitObjects]\r\n"
+        "64,192,0,1,0,0:0:0:0:\r\n"
+        "192,192,250.7,1,0,0:0:0:70:kick.wav\r\n"
+        "320,192,500,128,0,1000:0:0:0:0:\r\n"
+        "448,192,750,128,0,1250:0:0:0:70:long note.wav\r\n";
+
+    void TestChart() {
+        O2BChartParser parse;
+        auto chart = parse(chartText);
+        Check(chart.AudioFilename == "audio.mp3", "AudioFilename");
+        Check(chart.AudioLeadIn == 500, "AudioLeadIn");
+        Check(chart.TitleUnicode == "\xE6\x9B\xB2", "TitleUnicode");
+        Check(chart.ArtistUnicode == "Artist", "ArtistUnicode");
+        Check(chart.KeyCount == 4, "key count from CircleSize");
+
+        Check(chart.Events.size() == 3, "storyboard objects and commands are dropped");
+        if (chart.Events.size() == 3) {
+            Check(chart.Events[0].Type == O2BChart::EventType::Background && chart.Events[0].FilePath == "bg.jpg", "background");
+            Check(chart.Events[1].Type == O2BChart::EventType::Video && chart.Events[1].Time == 120
+                && chart.Events[1].FilePath == "video.mp4", "video");
+            Check(chart.Events[2].Type == O2BChart::EventType::SoundEffect && chart.Events[2].Time == 1000
+                && chart.Events[2].FilePath == "clap.wav", "sample");
+        }
+
+        const auto &points = chart.TimingPoints;
+        Check(points.size() == 5, "timing point count");
+        if (points.size() == 5) {
+            Check(!points[0].Inherited && points[0].BeatsPerMinute == 120 && points[0].Meter == 4, "uninherited point");
+            Check(points[1].Inherited && points[1].Ratio == 0.5, "inherited point");
+            Check(!points[2].Inherited && points[2].BeatsPerMinute == 150 && points[2].Meter == 3, "meter change");
+            Check(points[3].Meter == 4, "meter 0 of old maps is 4/4");
+            Check(points[4].Inherited && points[4].Ratio == 2 && points[4].Meter == 4, "old format inherited point");
+        }
+
+        const auto &objects = chart.HitObjects;
+        Check(objects.size() == 4, "hit object count");
+        if (objects.size() == 4) {
+            for (size_t i = 0; i < 4; ++i) {
+                Check(objects[i].Column == i, "column of hit object " + to_string(i));
+            }
+            Check(!objects[0].IsHold && objects[0].HitSound.empty(), "note without key sound");
+            Check(objects[1].StartTime == 250 && objects[1].HitSound == "kick.wav", "fractional time and key sound");
+            Check(objects[2].IsHold && objects[2].StartTime == 500 && objects[2].EndTime == 1000
+                && objects[2].HitSound.empty(), "hold without key sound");
+            Check(objects[3].IsHold && objects[3].EndTime == 1250 && objects[3].HitSound == "long note.wav", "hold with key sound");
+        }
+
+        // The arrays are reused, never appended to
+        parse("osu file format v14\n[General]\nMode:3\n[Difficulty]\nCircleSize:7\n", chart);
+        Check(chart.KeyCount == 7 && chart.HitObjects.empty() && chart.TimingPoints.empty()
+            && chart.Events.empty() && chart.AudioFilename.empty(), "reused chart");
+    }
+
+    void TestErrors() {
+        Check(ErrorOf("osu file format v14\n[General]\nMode: 0\n") == "Line 3: Not an osu!mania beatmap", "osu!standard");
+        Check(ErrorOf("osu file format v14\n[General]\nMode: 1\n") == "Line 3: Not an osu!mania beatmap", "osu!taiko");
+        Check(ErrorOf("osu file format v5\n[General]\nAudioFilename: a.mp3\n") == "Not an osu!mania beatmap",
+            "old chart without a mode");
+        Check(ErrorOf("osu file format v14\n[TimingPoints]\n0,500,256,1,0,100,1,0\n") == "Line 3: Meter out of range [1, 255]",
+            "meter");
+        Check(ErrorOf("") == "Line 0: Not an osu! beatmap", "empty text");
+        Check(ErrorOf("\n[General]\n") == "Line 2: Not an osu! beatmap", "missing header");
+        Check(ErrorOf("osu file format v14\n[Difficulty]\nCircleSize:0\n") == "Line 3: Key count out of range [1, 18]",
+            "key count");
+        Check(ErrorOf("osu file format v14\n[HitObjects]\n64,192,0,1,0\n") == "Line 3: HitObjects appear before the key count",
+            "hit objects before the key count");
+        Check(ErrorOf("osu file format v14\n[TimingPoints]\n0,five hundred\n") == "Line 3: Invalid number \"five hundred\"",
+            "invalid number");
+        Check(ErrorOf("osu file format v14\n[Difficulty]\nCircleSize:4\n[HitObjects]\n64,192,x,1,0\n")
+            == "Line 5: Invalid integer \"x\"", "invalid integer");
+    }
+
+}
+
+int main() {
+    try {
+        TestChart();
+        TestErrors();
+    } catch (const O2BException &e) {
+        cerr << "FAILED: " << e.Description() << endl;
+        ++failureCount;
+    }
+    if (failureCount != 0) {
+        cerr << failureCount << " checks failed" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All checks passed" << endl;
+    return EXIT_SUCCESS;
+}
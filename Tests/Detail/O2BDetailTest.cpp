@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "_Detail/GridBitmap.hpp"
+#include "_Detail/InternTable.hpp"
+#include "_Detail/RadixSort.hpp"
+
+using namespace std;
+using namespace Osu2Bms;
+
+namespace {
+
+    size_t failureCount = 0;
+
+    void Check(bool condition, const string &what) {
+        if (!condition) {
+            cerr << "FAILED: " << what << endl;
+            ++failureCount;
+        }
+    }
+
+    // Compares with std::stable_sort on keys that need no pass, one pass and
+    // every pass, including negative and extreme values
+    void TestRadixSort() {
+        mt19937 random(7);
+        vector<vector<int32_t>> cases = {
+            {},
+            { 42 },
+            { 5, 5, 5, 5 },
+            { 3, -1, 2, -1, 0, numeric_limits<int32_t>::min(), numeric_limits<int32_t>::max(), 2 },
+        };
+        vector<int32_t> times(10000);
+        for (auto &time : times) {
+            time = static_cast<int32_t>(random() % 600000);
+        }
+        cases.push_back(times);
+        vector<int32_t> wide(10000);
+        for (auto &key : wide) {
+            key = static_cast<int32_t>(random());
+        }
+        cases.push_back(wide);
+        vector<uint32_t> order, scratch;
+        for (size_t c = 0; c < cases.size(); ++c) {
+            const auto &keys = cases[c];
+            _Detail::StableRadixOrder(keys, order, scratch);
+            vector<uint32_t> expected(keys.size());
+            iota(expected.begin(), expected.end(), 0);
+            stable_sort(expected.begin(), expected.end(), [&keys](uint32_t lhs, uint32_t rhs) {
+                return keys[lhs] < keys[rhs];
+            });
+            Check(order == expected, "radix order of case " + to_string(c));
+        }
+        vector<string> values = { "c", "a", "b" };
+        vector<string> valueScratch;
+        _Detail::ApplyOrder(values, { 1, 2, 0 }, valueScratch);
+        Check(values == vector<string>({ "a", "b", "c" }), "apply order");
+    }
+
+    void TestInternTable() {
+        _Detail::InternTable<string, hash<string_view>> table;
+        const vector<string> inserted = { "snare.wav", "kick.wav", "snare.wav", "hat.wav", "kick.wav" };
+        vector<size_t> provisional;
+        for (const auto &value : inserted) {
+            provisional.push_back(table.Insert(string_view(value)));
+        }
+        Check(provisional == vector<size_t>({ 1, 2, 1, 3, 2 }), "provisional IDs in insertion order");
+        Check(table.Size() == 3, "duplicates are merged");
+        table.Finalize();
+        Check(table.Value(1) == "hat.wav" && table.Value(2) == "kick.wav" && table.Value(3) == "snare.wav",
+            "values are sorted");
+        Check(table.Resolve(1) == 3 && table.Resolve(2) == 2 && table.Resolve(3) == 1, "provisional IDs resolve");
+        Check(table.IdOf(string_view("kick.wav")) == 2, "IdOf after Finalize");
+        bool missing = false;
+        try {
+            table.IdOf(string_view("clap.wav"));
+        } catch (const out_of_range &) {
+            missing = true;
+        }
+        Check(missing, "IdOf of a missing value");
+
+        // Enough values to grow the index several times, then a reuse
+        table.Clear();
+        Check(table.Size() == 0, "Clear");
+        for (int i = 0; i < 5000; ++i) {
+            table.Insert(to_string(i % 1000));
+        }
+        Check(table.Size() == 1000, "size after growing");
+        table.Finalize();
+        bool sorted = true;
+        for (size_t id = 2; id <= table.Size(); ++id) {
+            sorted = sorted && table.Value(id - 1) < table.Value(id);
+        }
+        Check(sorted, "values are sorted after growing");
+        Check(table.Value(table.IdOf(string("123"))) == "123", "IdOf after growing");
+
+        _Detail::InternTable<double> bpms;
+        bpms.Insert(180.0);
+        bpms.Insert(90.0);
+        bpms.Insert(180.0);
+        bpms.Finalize();
+        Check(bpms.Size() == 2 && bpms.Value(1) == 90 && bpms.Resolve(1) == 2, "double values");
+    }
+
+    void TestGridBitmap() {
+        _Detail::GridBitmap bitmap;
+        Check(!bitmap.Any(), "new bitmap is empty");
+        const vector<size_t> indices = { 0, 1, 63, 64, 127, 128, 200, 255 };
+        for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+            bitmap.Set(*it);
+        }
+        bitmap.Set(64);
+        Check(bitmap.Any(), "Any");
+        Check(bitmap.Test(63) && bitmap.Test(255) && !bitmap.Test(2) && !bitmap.Test(254), "Test");
+        vector<size_t> visited;
+        bitmap.ForEach([&visited](size_t i) {
+            visited.push_back(i);
+        });
+        Check(visited == indices, "ForEach visits set indices in ascending order");
+        bitmap.Clear();
+        Check(!bitmap.Any(), "Clear");
+        Check(_Detail::CountTrailingZeros(uint64_t(1) << 63) == 63, "CountTrailingZeros");
+    }
+
+}
+
+int main() {
+    TestRadixSort();
+    TestInternTable();
+    TestGridBitmap();
+    if (failureCount != 0) {
+        cerr << failureCount << " checks failed" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All checks passed" << endl;
+    return EXIT_SUCCESS;
+}
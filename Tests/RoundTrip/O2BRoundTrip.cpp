@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "O2BException.hpp"
+#include "O2BZipArchive.hpp"
+#include "O2BZipWriter.hpp"
+#include "_Detail/Deflate.hpp"
+#include "_Detail/Inflate.hpp"
+
+using namespace std;
+using namespace Osu2Bms;
+
+namespace {
+
+    size_t failureCount = 0;
+
+    void Check(bool condition, const string &what) {
+        if (!condition) {
+            cerr << "FAILED: " << what << endl;
+            ++failureCount;
+        }
+    }
+
+    // Inputs from incompressible to highly repetitive, including the lengths
+    // around DEFLATE's 258 byte matches and 32 KiB window
+    vector<pair<string, string>> GenerateInputs() {
+        mt19937 random(2024);
+        vector<pair<string, string>> inputs;
+        inputs.emplace_back("empty", "");
+        inputs.emplace_back("single byte", "x");
+        inputs.emplace_back("run of 258", string(258, 'a'));
+        inputs.emplace_back("run of 1 MiB", string(1 << 20, 'a'));
+        string noise(100000, '\0');
+        for (auto &c : noise) {
+            c = static_cast<char>(random());
+        }
+        inputs.emplace_back("noise", noise);
+        string chart;
+        for (int i = 0; chart.size() < 200000; ++i) {
+            chart += to_string(64 + 128 * (i % 4)) + ",192," + to_string(i * 125) + ",1,0,0:0:0:0:\n";
+        }
+        inputs.emplace_back("hit objects", chart);
+        string far;
+        for (int i = 0; i < 8; ++i) {
+            far += noise.substr(0, 40000);
+        }
+        inputs.emplace_back("repeats beyond the window", far);
+        return inputs;
+    }
+
+    void TestDeflate(const vector<pair<string, string>> &inputs) {
+        for (const auto &input : inputs) {
+            const auto &data = input.second;
+            auto deflated = _Detail::Deflate(data.data(), data.size());
+            Check(_Detail::Inflate(deflated.data(), deflated.size(), data.size()) == data, "deflate " + input.first);
+            if (data.empty()) {
+                continue;
+            }
+            bool refused = false;
+            try {
+                _Detail::Inflate(deflated.data(), deflated.size(), data.size() - 1);
+            } catch (const O2BException &) {
+                refused = true;
+            }
+            Check(refused, "inflate " + input.first + " past its limit");
+        }
+    }
+
+    void TestZip(const vector<pair<string, string>> &inputs) {
+        {
+            O2BZipWriter writer("O2BRoundTrip.zip");
+            for (const auto &input : inputs) {
+                // Names decide whether an entry is deflated or stored
+                writer.Add(input.first + ".osu", input.second);
+                writer.Add(input.first + ".ogg", input.second);
+            }
+            writer.Close();
+        }
+        {
+            O2BZipArchive archive("O2BRoundTrip.zip");
+            Check(archive.Entries().size() == inputs.size() * 2, "zip entry count");
+            O2BZipWriter copy("O2BRoundTripCopy.zip");
+            for (const auto &entry : archive.Entries()) {
+                copy.AddEntry(entry.Name, archive, entry);
+            }
+            copy.Close();
+        }
+        O2BZipArchive copy("O2BRoundTripCopy.zip");
+        const auto &entries = copy.Entries();
+        Check(entries.size() == inputs.size() * 2, "copied zip entry count");
+        for (size_t i = 0; i < entries.size() && i / 2 < inputs.size(); ++i) {
+            const auto &input = inputs[i / 2];
+            Check(entries[i].Name == input.first + (i % 2 == 0 ? ".osu" : ".ogg"), "zip entry name " + entries[i].Name);
+            Check(copy.Read(entries[i]) == input.second, "zip entry " + entries[i].Name);
+        }
+    }
+
+    // A copied entry must be checked, since it is not inflated on the way
+    void TestCorruptedCopy() {
+        const string body = "a sample which is stored as it is";
+        {
+            O2BZipWriter writer("O2BRoundTripCorrupted.zip");
+            writer.Add("sample.ogg", body);
+            writer.Close();
+        }
+        {
+            fstream file("O2BRoundTripCorrupted.zip", ios::in | ios::out | ios::binary);
+            string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+            file.seekp(static_cast<streamoff>(bytes.find(body)));
+            file.put('A');
+        }
+        O2BZipArchive archive("O2BRoundTripCorrupted.zip");
+        O2BZipWriter copy("O2BRoundTripCorruptedCopy.zip");
+        bool refused = false;
+        try {
+            copy.AddEntry("sample.ogg", archive, archive.Entries().front());
+        } catch (const O2BException &) {
+            refused = true;
+        }
+        Check(refused, "copy a corrupted entry");
+    }
+
+}
+
+int main() {
+    try {
+        auto inputs = GenerateInputs();
+        TestDeflate(inputs);
+        TestZip(inputs);
+        TestCorruptedCopy();
+    } catch (const O2BException &e) {
+        cerr << "FAILED: " << e.Description() << endl;
+        ++failureCount;
+    }
+    if (failureCount != 0) {
+        cerr << failureCount << " checks failed" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All checks passed" << endl;
+    return EXIT_SUCCESS;
+}